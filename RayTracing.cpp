@@ -1,6 +1,8 @@
 ﻿// RayTracing.cpp : Defines the entry point for the application.
 
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include "RayTracing.hpp"
 #include "scene.hpp"
@@ -22,18 +24,67 @@ int main(int argc, char *argv[])
 	// Time
 	const auto start_time = std::chrono::steady_clock::now();
 	std::clog << "C++ version: " << __cplusplus << "\n";
+
+	// Options (e.g. --threads 8) may appear anywhere, everything else is a positional argument
+	std::vector<char*> args;
+	int threads = 1;
+	uint64_t seed = 0;
+	int pass_samples = 0;
+	std::string checkpoint_file;
+	double checkpoint_interval = 300;
+	bool resume = false;
+	double adaptive_threshold = 0;
+	int adaptive_max_samples = 0;
+	integrator_type integrator = integrator_iterative;
+	int russian_roulette_depth = 5;
+	for (int i = 0; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (arg == "--seed" && i + 1 < argc)
+			seed = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--pass-samples" && i + 1 < argc)
+			pass_samples = atoi(argv[++i]);
+		else if (arg == "--checkpoint" && i + 1 < argc)
+			checkpoint_file = argv[++i];
+		else if (arg == "--checkpoint-interval" && i + 1 < argc)
+			checkpoint_interval = atof(argv[++i]);
+		else if (arg == "--resume")
+			resume = true;
+		else if (arg == "--adaptive" && i + 1 < argc)
+			adaptive_threshold = atof(argv[++i]);
+		else if (arg == "--adaptive-max" && i + 1 < argc)
+			adaptive_max_samples = atoi(argv[++i]);
+		else if (arg == "--recursive")
+			integrator = integrator_recursive;
+		else if (arg == "--wavefront")
+			integrator = integrator_wavefront;
+		else if (arg == "--roulette-depth" && i + 1 < argc)
+			russian_roulette_depth = atoi(argv[++i]);
+		else if (arg == "--bvh" && i + 1 < argc) {
+			std::string name = argv[++i];
+			bvh_node::builder = name == "median" ? bvh_median : name == "sbvh" ? bvh_sbvh : bvh_sah;
+		}
+		else if (arg == "--sbvh-budget" && i + 1 < argc)
+			bvh_tree::spatial_split_budget = atof(argv[++i]);
+		else if (arg == "--bvh-width" && i + 1 < argc)
+			bvh_hierarchy::branching = atoi(argv[++i]);
+		else if (arg == "--no-mesh-cache")
+			mesh_cache::enabled = false;
+		else if (arg == "--compress-meshes")
+			triangle_mesh::compress = true;
+		else
+			args.push_back(argv[i]);
+	}
+	argc = int(args.size());
+	argv = args.data();
 	
-	// File output
+	// File output, the extension picks the image format (.ppm, .png or .hdr)
 	std::ofstream file;
 	bool fileOpened = false;
-	if (argc >= 2) {
-		file.open(argv[1]);
-		std::clog << "Opened file: '" << argv[1] << "'";
-	}
-	else {
-		file.open("output.ppm");
-		std::clog << "Opened file: 'output.ppm'";
-	}
+	std::string filename = (argc >= 2) ? argv[1] : "output.ppm";
+	file.open(filename, std::ios::binary);
+	std::clog << "Opened file: '" << filename << "'";
 	if (file.is_open()) {
 		fileOpened = true;
 		std::clog << " successfully\n";
@@ -42,92 +93,43 @@ int main(int argc, char *argv[])
 		std::clog << " unsuccessfully\n";
 	}
 
-	scene scene = SCENE_H::three_spheres();
-	if (argc >= 3) {
-		int value = atoi(argv[2]);
-		switch (value)
-		{
-		case 1:
-			scene = SCENE_H::many_spheres(false);
-			break;
-		case 2:
-			scene = SCENE_H::many_spheres(true);
-			break;
-		case 3:
-			scene = SCENE_H::checkered_spheres();
-			break;
-		case 4:
-			scene = SCENE_H::earth();
-			break;
-		case 5:
-			scene = SCENE_H::perlin_spheres();
-			break;
-		case 6:
-			scene = SCENE_H::quads();
-			break;
-		case 7:
-			scene = SCENE_H::quads2();
-			break;
-		case 8:
-			scene = SCENE_H::mandelbrot();
-			break;
-		case 9:
-			scene = SCENE_H::simple_light();
-			break;
-		case 10:
-			scene = SCENE_H::cornell_box();
-			break;
-		case 11:
-			scene = SCENE_H::cornell_box2();
-			break;
-		case 12:
-			scene = SCENE_H::cornell_box3();
-			break;
-		case 13: // Black
-			scene = SCENE_H::cornell_smoke();
-			break;
-		case 14: // Black
-			scene = SCENE_H::final_scene();
-			break;
-		case 15:
-			scene = SCENE_H::glass_boxes();
-			break;
-		case 16:
-			scene = SCENE_H::bunny();
-			break;
-		case 17:
-			scene = SCENE_H::dragon();
-			break;
-		case 18:
-			scene = SCENE_H::obj_test();
-			break;
-		default:
-			scene = SCENE_H::three_spheres();
-			break;
-		}
-	}
+	bvh_tree::build_threads = threads;
+	obj_parser::threads = threads;
+	scene scene = SCENE_H::select_scene(argc >= 3 ? atoi(argv[2]) : 0);
+	std::clog << "BVH (" << bvh_builder_name(bvh_node::builder) << ") traversal cost: " << scene.traversal_cost() << "\n";
+	scene.get_camera().thread_count = threads;
+	scene.get_camera().seed = seed;
+	scene.get_camera().samples_per_pass = pass_samples;
+	scene.get_camera().checkpoint_file = checkpoint_file;
+	scene.get_camera().checkpoint_interval = checkpoint_interval;
+	scene.get_camera().resume = resume;
+	scene.get_camera().adaptive_threshold = adaptive_threshold;
+	scene.get_camera().adaptive_max_samples = adaptive_max_samples;
+	scene.get_camera().integrator = integrator;
+	scene.get_camera().russian_roulette_depth = russian_roulette_depth;
+
+	framebuffer image;
 	if (argc >= 4) {
 		int value = atoi(argv[3]);
-		if (fileOpened) {
-			scene.high_res_render(file, value);
-		} else {
-			scene.high_res_render(std::cout, value);
-		}
+		scene.high_res_render(image, value);
 	}
 	else {
-		if (fileOpened) {
-			scene.render(file);
-		} else {
-			scene.render(std::cout);
-		}
+		scene.render(image);
 	}
 
-	if (fileOpened)
+	if (fileOpened) {
+		image.write(file, filename);
 		file.close();
+	} else {
+		image.write(std::cout, filename);
+	}
 	
 	const auto end_time = std::chrono::steady_clock::now();
 	const auto elapsed_seconds = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
 	std::clog << "elapsed time: " << elapsed_seconds / 1000.0 << "s\n";
+#ifdef RT_ENABLE_COUNTERS
+	total_counters().print(std::clog);
+#endif
 
 	return 0;
 }
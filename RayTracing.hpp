@@ -10,6 +10,7 @@
 #include <limits>
 #include <memory>
 
+#include "rng.hpp"
 
 // C++ STD usings
 
@@ -28,8 +29,8 @@ inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-	// Returns a random real in [0, 1)
-	return std::rand() / (RAND_MAX + 1.0);
+	// Returns a random real in [0, 1) from this thread's generator
+	return thread_random_stream().generator.next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -45,6 +46,7 @@ inline int random_int(int min, int max) {
 // Common Headers
 
 #include "colour.hpp"
+#include "counters.hpp"
 #include "interval.hpp"
 #include "ray.hpp"
 #include "vec3.hpp"
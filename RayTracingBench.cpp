@@ -0,0 +1,176 @@
+// RayTracingBench.cpp : Renders every scene at fixed settings and reports timings as JSON, so regressions can be tracked between commits
+// Usage: RayTracingBench [output.json] [--width N] [--spp N] [--threads N] [--seed N] [--scene N] [--bvh median|sah] [--bvh-width 2|4|8]
+
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RayTracing.hpp"
+#include "scene.hpp"
+
+#ifndef RT_GIT_COMMIT
+#define RT_GIT_COMMIT "unknown"
+#endif
+
+#ifndef RT_BUILD_TYPE
+#define RT_BUILD_TYPE "unknown"
+#endif
+
+struct scene_result {
+	int index;
+	double setup_seconds; // Building the scene, BVH build included
+	double bvh_build_seconds;
+	double bvh_cost; // scene::traversal_cost
+	render_stats render;
+};
+
+static std::string compiler_name() {
+#if defined(_MSC_VER)
+	return "MSVC " + std::to_string(_MSC_VER);
+#elif defined(__clang__)
+	return std::string("Clang ") + __clang_version__;
+#elif defined(__GNUC__)
+	return std::string("GCC ") + __VERSION__;
+#else
+	return "unknown";
+#endif
+}
+
+static std::string platform_name() {
+#if defined(_WIN32)
+	return "windows";
+#elif defined(__APPLE__)
+	return "macos";
+#elif defined(__linux__)
+	return "linux";
+#else
+	return "unknown";
+#endif
+}
+
+static std::string timestamp() {
+	std::time_t now = std::time(nullptr);
+	char buffer[32];
+	std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+	return buffer;
+}
+
+int main(int argc, char* argv[])
+{
+	// Fixed, small settings so every scene finishes in seconds, and every run traces the exact same rays
+	int width = 96;
+	int samples = 16;
+	int threads = 0;
+	uint64_t seed = 0;
+	int only_scene = -1;
+	std::string output_filename;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--width" && i + 1 < argc)
+			width = atoi(argv[++i]);
+		else if (arg == "--spp" && i + 1 < argc)
+			samples = atoi(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (arg == "--seed" && i + 1 < argc)
+			seed = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--scene" && i + 1 < argc)
+			only_scene = atoi(argv[++i]);
+		else if (arg == "--bvh" && i + 1 < argc) {
+			std::string name = argv[++i];
+			bvh_node::builder = name == "median" ? bvh_median : name == "sbvh" ? bvh_sbvh : bvh_sah;
+		}
+		else if (arg == "--sbvh-budget" && i + 1 < argc)
+			bvh_tree::spatial_split_budget = atof(argv[++i]);
+		else if (arg == "--bvh-width" && i + 1 < argc)
+			bvh_hierarchy::branching = atoi(argv[++i]);
+		else if (arg == "--no-mesh-cache")
+			mesh_cache::enabled = false;
+		else if (arg == "--compress-meshes")
+			triangle_mesh::compress = true;
+		else
+			output_filename = arg;
+	}
+	int worker_threads = threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()));
+	bvh_tree::build_threads = worker_threads;
+	obj_parser::threads = worker_threads;
+
+	std::vector<scene_result> results;
+	for (int index = 0; index < scene_count; index++) {
+		if (only_scene >= 0 && index != only_scene)
+			continue;
+		std::clog << "Scene " << index << " (" << scene_name(index) << ")\n";
+
+		// Scene layouts are random, so every scene starts from the same generator state as a fresh process would
+		thread_random_stream() = random_stream();
+		bvh_node::total_build_seconds = 0;
+
+		scene_result result;
+		result.index = index;
+		auto setup_start = std::chrono::steady_clock::now();
+		scene bench_scene = select_scene(index);
+		result.setup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - setup_start).count();
+		result.bvh_build_seconds = bvh_node::total_build_seconds;
+		result.bvh_cost = bench_scene.traversal_cost();
+
+		camera& cam = bench_scene.get_camera();
+		cam.image_width = width;
+		cam.samples_per_pixel = samples;
+		cam.thread_count = worker_threads;
+		cam.seed = seed;
+
+		framebuffer image;
+		bench_scene.render(image);
+		result.render = cam.stats;
+		results.push_back(result);
+	}
+
+	// JSON report
+	std::ofstream file;
+	if (!output_filename.empty())
+		file.open(output_filename);
+	std::ostream& out = file.is_open() ? file : std::cout;
+
+	double total_seconds = 0;
+	out << "{\n";
+	out << "  \"commit\": \"" << RT_GIT_COMMIT << "\",\n";
+	out << "  \"build_type\": \"" << RT_BUILD_TYPE << "\",\n";
+	out << "  \"compiler\": \"" << compiler_name() << "\",\n";
+	out << "  \"platform\": \"" << platform_name() << "\",\n";
+	out << "  \"timestamp\": \"" << timestamp() << "\",\n";
+	out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+	out << "  \"threads\": " << worker_threads << ",\n";
+	out << "  \"image_width\": " << width << ",\n";
+	out << "  \"samples_per_pixel\": " << samples << ",\n";
+	out << "  \"seed\": " << seed << ",\n";
+	out << "  \"bvh_builder\": \"" << bvh_builder_name(bvh_node::builder) << "\",\n";
+	out << "  \"bvh_width\": " << bvh_hierarchy::branching << ",\n";
+	out << "  \"mesh_cache\": " << (mesh_cache::enabled ? "true" : "false") << ",\n";
+	out << "  \"compress_meshes\": " << (triangle_mesh::compress ? "true" : "false") << ",\n";
+	out << "  \"scenes\": [\n";
+	for (size_t r = 0; r < results.size(); r++) {
+		const scene_result& result = results[r];
+		const render_stats& render = result.render;
+		total_seconds += render.seconds;
+		out << "    {"
+			<< "\"index\": " << result.index
+			<< ", \"name\": \"" << scene_name(result.index) << "\""
+			<< ", \"setup_seconds\": " << result.setup_seconds
+			<< ", \"bvh_build_seconds\": " << result.bvh_build_seconds
+			<< ", \"bvh_cost\": " << result.bvh_cost
+			<< ", \"render_seconds\": " << render.seconds
+			<< ", \"samples\": " << render.samples
+			<< ", \"rays\": " << render.rays
+			<< ", \"samples_per_second\": " << (render.seconds > 0 ? render.samples / render.seconds : 0)
+			<< ", \"rays_per_second\": " << (render.seconds > 0 ? render.rays / render.seconds : 0)
+			<< "}" << (r + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ],\n";
+	out << "  \"total_render_seconds\": " << total_seconds << "\n";
+	out << "}\n";
+
+	return 0;
+}
@@ -63,30 +63,24 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t) const {
+		return hit(slab_ray(r), ray_t);
+	}
+
+	bool hit(const slab_ray& r, interval ray_t) const {
+		RT_COUNT(box_tests);
 		const point3& ray_orig = r.origin();
-		const vec3& ray_dir = r.direction();
-		
+		const vec3& inv_dir = r.inv_direction();
+
 		for (int axis = 0; axis < 3; axis++) {
 			const interval& ax = axis_interval(axis);
-			const double adinv = 1.0 / ray_dir[axis];
-
-			double t0 = (ax.min - ray_orig[axis]) * adinv;
-			double t1 = (ax.max - ray_orig[axis]) * adinv;
-			
-			// Somehow also slower
-			//if (adinv < 0)
-			//	std::swap(t0, t1);
-			//ray_t.min = (t0 > ray_t.min) ? t0 : ray_t.min;
-			//ray_t.max = (t1 < ray_t.max) ? t1 : ray_t.max;
-			
-			if (t0 < t1) {
-				if (t0 > ray_t.min) ray_t.min = t0;
-				if (t1 < ray_t.max) ray_t.max = t1;
-			}
-			else {
-				if (t1 > ray_t.min) ray_t.min = t1;
-				if (t0 < ray_t.max) ray_t.max = t0;
-			}
+			const int sign = r.direction_sign(axis);
+
+			// The ray's sign picks the slab side it enters through, so t_near <= t_far without comparing them
+			// A NaN (origin on the plane of an axis parallel ray) fails both comparisons and leaves ray_t alone
+			double t_near = ((sign ? ax.max : ax.min) - ray_orig[axis]) * inv_dir[axis];
+			double t_far = ((sign ? ax.min : ax.max) - ray_orig[axis]) * inv_dir[axis];
+			ray_t.min = t_near > ray_t.min ? t_near : ray_t.min;
+			ray_t.max = t_far < ray_t.max ? t_far : ray_t.max;
 
 			if (ray_t.max <= ray_t.min)
 				return false;
@@ -135,6 +129,12 @@ public:
 			return y.size() > z.size() ? 1 : 2;
 	}
 
+	double surface_area() const {
+		if (x.size() < 0 || y.size() < 0 || z.size() < 0)
+			return 0;
+		return 2.0 * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+	}
+
 	void pad_to_minimums() {
 		// Adjust the AABB so that no side is narrower than some delta, padding if necessary
 		double delta = 0.0001;
@@ -0,0 +1,126 @@
+#ifndef ACCUMULATION_BUFFER_H
+#define ACCUMULATION_BUFFER_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Running per-pixel sums of every sample traced so far
+// Progressive renders add one pass of samples at a time, and the whole buffer can be checkpointed to disk and resumed later
+// Besides the colour sum, every pixel keeps its sample count and the sum of squared luminances, so its variance can be estimated for adaptive sampling
+class accumulation_buffer {
+public:
+	accumulation_buffer() {}
+	accumulation_buffer(int width, int height) : buffer_width(width), buffer_height(height), sums(size_t(width) * height), luminance_squares(size_t(width) * height, 0.0), counts(size_t(width) * height, 0) {}
+
+	colour& sum(int i, int j) { return sums[size_t(j) * buffer_width + i]; }
+	const colour& sum(int i, int j) const { return sums[size_t(j) * buffer_width + i]; }
+
+	double& luminance_square_sum(int i, int j) { return luminance_squares[size_t(j) * buffer_width + i]; }
+
+	int& count(int i, int j) { return counts[size_t(j) * buffer_width + i]; }
+	int count(int i, int j) const { return counts[size_t(j) * buffer_width + i]; }
+
+	long long total_count() const {
+		long long total = 0;
+		for (int c : counts)
+			total += c;
+		return total;
+	}
+
+	colour mean(int i, int j) const {
+		return (1.0 / count(i, j)) * sum(i, j);
+	}
+
+	double relative_error(int i, int j) const {
+		// Standard error of the pixel's mean luminance, relative to that mean
+		// The mean is floored at one 8-bit step so near-black pixels aren't chased forever
+		int n = count(i, j);
+		if (n < 2)
+			return infinity;
+		double mean_luminance = luminance(sum(i, j)) / n;
+		double variance = (luminance_squares[size_t(j) * buffer_width + i] - n * mean_luminance * mean_luminance) / (n - 1);
+		double standard_error = std::sqrt(std::fmax(0.0, variance) / n);
+		return standard_error / std::fmax(mean_luminance, 1.0 / 256.0);
+	}
+
+	static double luminance(const colour& c) {
+		return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+	}
+
+	bool save(const std::string& filename, uint64_t settings_key) const {
+		// Written to a temporary file first and then renamed, so being pre-empted mid write never destroys the last good checkpoint
+		std::string temp_filename = filename + ".tmp";
+		{
+			std::ofstream file(temp_filename, std::ios::binary);
+			if (!file.is_open())
+				return false;
+
+			file.write(checkpoint_magic, sizeof(checkpoint_magic));
+			write_value(file, settings_key);
+			write_value(file, buffer_width);
+			write_value(file, buffer_height);
+			file.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(colour));
+			file.write(reinterpret_cast<const char*>(luminance_squares.data()), luminance_squares.size() * sizeof(double));
+			file.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(int));
+			if (!file.good())
+				return false;
+		}
+		std::error_code error;
+		std::filesystem::rename(temp_filename, filename, error);
+		return !error;
+	}
+
+	bool load(const std::string& filename, uint64_t settings_key) {
+		// Only accepts a checkpoint taken with the same image size and sampling settings, otherwise the buffer is left untouched
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		char magic[sizeof(checkpoint_magic)];
+		uint64_t key = 0;
+		int width = 0, height = 0;
+		file.read(magic, sizeof(magic));
+		read_value(file, key);
+		read_value(file, width);
+		read_value(file, height);
+		if (!file.good() || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 || key != settings_key || width != buffer_width || height != buffer_height)
+			return false;
+
+		std::vector<colour> loaded_sums(sums.size());
+		std::vector<double> loaded_squares(luminance_squares.size());
+		std::vector<int> loaded_counts(counts.size());
+		file.read(reinterpret_cast<char*>(loaded_sums.data()), loaded_sums.size() * sizeof(colour));
+		file.read(reinterpret_cast<char*>(loaded_squares.data()), loaded_squares.size() * sizeof(double));
+		file.read(reinterpret_cast<char*>(loaded_counts.data()), loaded_counts.size() * sizeof(int));
+		if (!file.good())
+			return false;
+
+		sums = std::move(loaded_sums);
+		luminance_squares = std::move(loaded_squares);
+		counts = std::move(loaded_counts);
+		return true;
+	}
+private:
+	static constexpr char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '2' };
+
+	int buffer_width = 0;
+	int buffer_height = 0;
+	std::vector<colour> sums; // Stored as doubles so resuming continues the exact same sums
+	std::vector<double> luminance_squares;
+	std::vector<int> counts;
+
+	template <typename T>
+	static void write_value(std::ofstream& file, const T& value) {
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	static void read_value(std::ifstream& file, T& value) {
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+	}
+};
+
+#endif
@@ -1,9 +1,33 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "accumulation_buffer.hpp"
+#include "framebuffer.hpp"
 #include "objects/hittable.hpp"
 #include "material.hpp"
+#include "path_queue.hpp"
 #include "pdf.hpp"
+#include "tile_queue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Work done by the last camera::render call, for benchmarking
+struct render_stats {
+	long long samples = 0; // Camera samples traced (summed over all pixels)
+	long long rays = 0; // Rays traced into the world, camera rays included
+	double seconds = 0; // Wall clock time of the render
+};
+
+// How camera::render turns a camera ray into a colour
+enum integrator_type {
+	integrator_recursive, // ray_colour, one call per bounce up to max_depth
+	integrator_iterative, // A loop carrying the path throughput, with Russian roulette after russian_roulette_depth bounces
+	integrator_wavefront // The iterative integrator over batches of paths, one bounce at a time, with shading grouped by material
+};
 
 class camera {
 public:
@@ -22,31 +46,122 @@ public:
 	double defocus_angle = 0; // Variation angle of rays through each pixel
 	double focus_dist = 10; // Distance from camera lookfrom point to plane of perfect focus
 
-	void render(std::ostream& file, const hittable& world, const hittable& lights, bool hasLights) {
+	int thread_count = 1; // Number of worker threads rendering tiles, 0 uses every hardware thread
+	int tile_size = 16; // Width and height of the square tiles handed to the worker threads
+	uint64_t seed = 0; // Seed for the per-sample random streams, the same seed gives the same image for any thread count
+
+	int samples_per_pass = 0; // Samples per pixel traced in each progressive pass, 0 traces them all in one pass (or one stratum row per pass when checkpointing)
+	std::string checkpoint_file = ""; // File the accumulated samples are checkpointed to, empty disables checkpoints
+	double checkpoint_interval = 300; // Minimum number of seconds between checkpoints
+	bool resume = false; // Continue from the checkpoint file instead of starting over
+
+	double adaptive_threshold = 0; // Relative error at which a pixel stops taking samples, 0 gives every pixel the full samples_per_pixel
+	int adaptive_min_samples = 16; // Samples every pixel takes before its error estimate is trusted
+	int adaptive_max_samples = 0; // Cap on the samples of a single noisy pixel, 0 uses 4 * samples_per_pixel
+
+	integrator_type integrator = integrator_iterative; // Path tracing integrator
+	int russian_roulette_depth = 5; // Bounces every path makes before Russian roulette can end it early
+	int wavefront_size = 4096; // Paths traced together by the wavefront integrator
+
+	render_stats stats; // Filled in by render()
+
+	void render(framebuffer& image, const hittable& world, const hittable& lights, bool hasLights) {
+		auto start_time = std::chrono::steady_clock::now();
 		initialize();
+		image = framebuffer(image_width, image_height);
 
-		file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-		for (int j = 0; j < image_height; j++)
-		{
-			std::clog << "\rScanlines remaining: " << (image_height - j) << " / " << image_height << " (" << (j * 100 / image_height) << "%)     " << std::flush;
-			for (int i = 0; i < image_width; i++)
-			{
-				colour pixel_colour(0, 0, 0);
-				// Stratified to improve render quality
-				for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-					for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-						ray r = get_ray(i, j, s_i, s_j);
-						pixel_colour += ray_colour(r, max_depth, world, lights, hasLights);
-					}
+		// Every pixel gets total_samples, unless adaptive sampling stops it early and hands its unused samples to noisier pixels (up to sample_cap each)
+		bool adaptive = adaptive_threshold > 0;
+		int total_samples = sqrt_spp * sqrt_spp;
+		int sample_cap = adaptive ? std::max(total_samples, adaptive_max_samples > 0 ? adaptive_max_samples : 4 * total_samples) : total_samples;
+		int min_samples = std::min(adaptive_min_samples, total_samples);
+		long long sample_budget = (long long)total_samples * image_width * image_height;
+		int pass_samples = samples_per_pass > 0 ? samples_per_pass : (checkpoint_file.empty() && !adaptive ? total_samples : sqrt_spp);
+
+		accumulation_buffer accumulation(image_width, image_height);
+		if (resume && !checkpoint_file.empty()) {
+			if (accumulation.load(checkpoint_file, settings_key()))
+				std::clog << "Resuming from '" << checkpoint_file << "' at " << accumulation.total_count() << " / " << sample_budget << " samples\n";
+			else
+				std::clog << "Couldn't resume from '" << checkpoint_file << "', starting from scratch\n";
+		}
+
+		int workers = thread_count > 0 ? thread_count : std::max(1, int(std::thread::hardware_concurrency()));
+		auto last_checkpoint = std::chrono::steady_clock::now();
+		std::vector<unsigned char> active(size_t(image_width) * image_height);
+		long long samples_before = accumulation.total_count();
+		std::atomic<long long> rays_traced = 0;
+
+		// Each pass adds the next range of stratified samples to every pixel that still needs them
+		// The choice of pixels only depends on the accumulated samples, so a resumed render makes the exact same choices
+		for (int pass = 1; ; pass++) {
+			long long samples_used = accumulation.total_count();
+			int active_count = 0;
+			for (int j = 0; j < image_height; j++) {
+				for (int i = 0; i < image_width; i++) {
+					int count = accumulation.count(i, j);
+					bool converged = adaptive && count >= min_samples && accumulation.relative_error(i, j) < adaptive_threshold;
+					bool needs_samples = adaptive ? (count < min_samples || (!converged && count < sample_cap && samples_used < sample_budget)) : count < total_samples;
+					active[size_t(j) * image_width + i] = needs_samples;
+					active_count += needs_samples;
 				}
-				write_colour(file, pixel_samples_scale * pixel_colour);
+			}
+			if (active_count == 0)
+				break;
+
+			// Don't let the last adaptive passes overrun the sample budget by much
+			int samples = pass_samples;
+			if (adaptive && samples_used >= (long long)min_samples * image_width * image_height)
+				samples = int(std::clamp<long long>((sample_budget - samples_used) / active_count, 1, pass_samples));
+
+			tile_queue tiles(image_width, image_height, tile_size, workers);
+			std::atomic<int> tiles_done = 0;
+
+			auto worker = [&](int index) {
+				thread_rays = 0;
+				tile t;
+				while (tiles.next(index, t)) {
+					render_tile(t, accumulation, active, samples, sample_cap, world, lights, hasLights);
+					int done = ++tiles_done;
+					// Only the calling thread reports progress so the log isn't interleaved
+					if (index == 0)
+						std::clog << "\rPass " << pass << " (" << active_count << " pixels), tiles remaining: " << (tiles.tile_count() - done) << " / " << tiles.tile_count() << " (" << (done * 100 / tiles.tile_count()) << "%)     " << std::flush;
+				}
+				rays_traced += thread_rays;
+				merge_thread_counters();
+			};
+
+			std::vector<std::thread> threads;
+			for (int k = 1; k < workers; k++)
+				threads.emplace_back(worker, k);
+			worker(0);
+			for (std::thread& thread : threads)
+				thread.join();
+
+			auto now = std::chrono::steady_clock::now();
+			if (!checkpoint_file.empty() && std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval) {
+				if (!accumulation.save(checkpoint_file, settings_key()))
+					std::clog << "\nCouldn't write checkpoint '" << checkpoint_file << "'\n";
+				last_checkpoint = now;
 			}
 		}
+		if (!checkpoint_file.empty() && !accumulation.save(checkpoint_file, settings_key()))
+			std::clog << "\nCouldn't write checkpoint '" << checkpoint_file << "'\n";
+
+		for (int j = 0; j < image_height; j++)
+			for (int i = 0; i < image_width; i++)
+				image.set(i, j, accumulation.mean(i, j));
 		std::clog << "\rDone.                              \n";
+
+		stats.samples = accumulation.total_count() - samples_before;
+		stats.rays = rays_traced;
+		stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		if (adaptive)
+			report_adaptive_sampling(accumulation, total_samples, sample_budget);
 	}
 private:
 	int image_height; // Rendered image height
-	double pixel_samples_scale; // Colour scale factor for a sum of pixel samples
 	int sqrt_spp; // Square root of number of samples per pixel
 	double reciprocal_sqrt_spp; // 1 / sqrt_spp
 	
@@ -58,6 +173,8 @@ private:
 	vec3 defocus_disk_u; // Defocus disk horizontal radius
 	vec3 defocus_disk_v; // Defocus disk vertial radius
 
+	static inline thread_local long long thread_rays = 0; // Rays traced by this thread in the current pass
+
 	void initialize() {
 		// Calculate the image height, and ensure that it's at least 1
 		image_height = int(image_width / aspect_ratio);
@@ -65,7 +182,6 @@ private:
 
 		sqrt_spp = int(std::sqrt(samples_per_pixel));
 		reciprocal_sqrt_spp = 1.0 / sqrt_spp;
-		pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
 
 		center = lookfrom;
 
@@ -97,6 +213,85 @@ private:
 		defocus_disk_v = v * defocus_radius;
 	}
 
+	void render_tile(const tile& t, accumulation_buffer& accumulation, const std::vector<unsigned char>& active, int samples, int sample_cap, const hittable& world, const hittable& lights, bool hasLights) const {
+		if (integrator == integrator_wavefront) {
+			render_tile_wavefront(t, accumulation, active, samples, sample_cap, world, lights, hasLights);
+			return;
+		}
+
+		int strata = sqrt_spp * sqrt_spp;
+		for (int j = t.y0; j < t.y1; j++) {
+			for (int i = t.x0; i < t.x1; i++) {
+				if (!active[size_t(j) * image_width + i])
+					continue;
+
+				// Samples are added straight onto the running sum in order, so any split into passes gives exactly the same sum
+				colour pixel_colour = accumulation.sum(i, j);
+				double luminance_squares = accumulation.luminance_square_sum(i, j);
+				int first_sample = accumulation.count(i, j);
+				int last_sample = std::min(first_sample + samples, sample_cap);
+
+				// Stratified to improve render quality, sample s lies in the stratum s_i, s_j (adaptive samples past the grid start it over)
+				for (int s = first_sample; s < last_sample; s++) {
+					int s_i = (s % strata) % sqrt_spp;
+					int s_j = (s % strata) / sqrt_spp;
+					seed_sample(seed, uint64_t(j) * image_width + i, uint64_t(s));
+					ray r = get_ray(i, j, s_i, s_j);
+					RT_COUNT(camera_rays);
+					colour sample_colour = integrator == integrator_recursive ? ray_colour(r, max_depth, world, lights, hasLights) : ray_colour_iterative(r, world, lights, hasLights);
+					pixel_colour += sample_colour;
+					double luminance = accumulation_buffer::luminance(sample_colour);
+					luminance_squares += luminance * luminance;
+				}
+				accumulation.sum(i, j) = pixel_colour;
+				accumulation.luminance_square_sum(i, j) = luminance_squares;
+				accumulation.count(i, j) = last_sample;
+			}
+		}
+	}
+
+	void report_adaptive_sampling(const accumulation_buffer& accumulation, int total_samples, long long sample_budget) const {
+		// How many samples the converged pixels saved, and how much of that went to the noisy ones
+		long long saved = 0;
+		long long extra = 0;
+		int stopped_early = 0;
+		for (int j = 0; j < image_height; j++) {
+			for (int i = 0; i < image_width; i++) {
+				int count = accumulation.count(i, j);
+				if (count < total_samples) {
+					saved += total_samples - count;
+					stopped_early++;
+				}
+				else {
+					extra += count - total_samples;
+				}
+			}
+		}
+		long long used = accumulation.total_count();
+		std::clog << "Adaptive sampling: " << stopped_early << " / " << (image_width * image_height) << " pixels stopped early, saving " << saved << " samples, "
+			<< extra << " extra samples went to noisy pixels, " << used << " / " << sample_budget << " samples used (" << (100.0 * used / sample_budget) << "%)\n";
+	}
+
+	uint64_t settings_key() const {
+		// Identifies the settings a checkpoint was taken with, resuming with different ones would mix two different images
+		auto bits = [](double value) { uint64_t b; std::memcpy(&b, &value, sizeof(b)); return b; };
+		uint64_t key = hash_combine(uint64_t(image_width), uint64_t(image_height));
+		key = hash_combine(key, uint64_t(sqrt_spp));
+		key = hash_combine(key, uint64_t(max_depth));
+		key = hash_combine(key, seed);
+		for (int axis = 0; axis < 3; axis++) {
+			key = hash_combine(key, bits(lookfrom[axis]));
+			key = hash_combine(key, bits(lookat[axis]));
+		}
+		key = hash_combine(key, bits(vfov));
+		key = hash_combine(key, bits(adaptive_threshold));
+		key = hash_combine(key, uint64_t(adaptive_min_samples));
+		key = hash_combine(key, uint64_t(adaptive_max_samples));
+		key = hash_combine(key, uint64_t(integrator));
+		key = hash_combine(key, uint64_t(russian_roulette_depth));
+		return key;
+	}
+
 	ray get_ray(int i, int j, int s_i, int s_j) const {
 		// Construct a camera ray originating from the defocus disk and directed at randomly sampled points around the pixel location i, j for stratified sample square s_i, s_j
 		vec3 offset = sample_square_stratified(s_i, s_j); //TODO: Can also use sample_disk(0.5);, or sample_square();
@@ -131,23 +326,152 @@ private:
 		return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 	}
 
+	void render_tile_wavefront(const tile& t, accumulation_buffer& accumulation, const std::vector<unsigned char>& active, int samples, int sample_cap, const hittable& world, const hittable& lights, bool hasLights) const {
+		// Generates the tile's camera rays (the same ones render_tile would) wavefront_size at a time, and traces each batch with trace_wavefront
+		int strata = sqrt_spp * sqrt_spp;
+		path_queue paths;
+		for (int j = t.y0; j < t.y1; j++) {
+			for (int i = t.x0; i < t.x1; i++) {
+				if (!active[size_t(j) * image_width + i])
+					continue;
+
+				int first_sample = accumulation.count(i, j);
+				int last_sample = std::min(first_sample + samples, sample_cap);
+				for (int s = first_sample; s < last_sample; s++) {
+					int s_i = (s % strata) % sqrt_spp;
+					int s_j = (s % strata) / sqrt_spp;
+					seed_sample(seed, uint64_t(j) * image_width + i, uint64_t(s));
+					paths.add(get_ray(i, j, s_i, s_j), j * image_width + i, thread_random_stream().sample_key);
+					RT_COUNT(camera_rays);
+
+					if (int(paths.size()) >= wavefront_size) {
+						trace_wavefront(paths, accumulation, world, lights, hasLights);
+						paths.clear();
+					}
+				}
+				accumulation.count(i, j) = last_sample;
+			}
+		}
+		if (paths.size() > 0)
+			trace_wavefront(paths, accumulation, world, lights, hasLights);
+	}
+
+	void trace_wavefront(path_queue& paths, accumulation_buffer& accumulation, const hittable& world, const hittable& lights, bool hasLights) const {
+		// Every bounce first intersects all live paths, then sorts the hits by material class and shades each class in one run, producing the next wavefront
+		// Each path keeps its own random state, so it makes the same decisions as in ray_colour_iterative and the image is identical
+		random_stream& stream = thread_random_stream();
+		std::vector<int> live(paths.size());
+		std::vector<int> hit_paths;
+		std::vector<int> sorted;
+		for (int path = 0; path < int(paths.size()); path++)
+			live[path] = path;
+
+		for (int bounce = 1; bounce <= max_depth && !live.empty(); bounce++) {
+			// Intersect
+			hit_paths.clear();
+			for (int path : live) {
+				stream.sample_key = paths.sample_keys[path];
+				seed_bounce(bounce);
+				thread_rays++;
+				RT_COUNT(total_rays);
+
+				ray r = paths.get_ray(path);
+				if (!world.hit(r, interval(0.001, infinity), paths.hits[path])) {
+					RT_COUNT(paths_ended_by_miss);
+					paths.radiances[path] += paths.throughputs[path] * background(r);
+					continue;
+				}
+				paths.generators[path] = stream.generator;
+				paths.materials[path] = paths.hits[path].mat_ptr->type();
+				hit_paths.push_back(path);
+			}
+
+			// Counting sort by material class
+			int group_start[material_type_count + 1] = {};
+			for (int path : hit_paths)
+				group_start[paths.materials[path] + 1]++;
+			for (int m = 0; m < material_type_count; m++)
+				group_start[m + 1] += group_start[m];
+			sorted.resize(hit_paths.size());
+			for (int path : hit_paths)
+				sorted[group_start[paths.materials[path]]++] = path;
+
+			// Shade
+			live.clear();
+			for (int path : sorted) {
+				stream.generator = paths.generators[path];
+				const hit_record& rec = paths.hits[path];
+				ray r = paths.get_ray(path);
+				colour& throughput = paths.throughputs[path];
+
+				scatter_record srec;
+				paths.radiances[path] += throughput * rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+				RT_COUNT(scatter_calls[paths.materials[path]]);
+				if (!rec.mat_ptr->scatter(r, rec, srec)) {
+					RT_COUNT(paths_ended_by_emission);
+					continue;
+				}
+
+				if (srec.skip_pdf) {
+					throughput = throughput * srec.attenuation;
+					paths.set_ray(path, srec.skip_pdf_ray);
+				}
+				else {
+					ray scattered;
+					double weight = sample_scatter(r, rec, srec, lights, hasLights, scattered);
+					throughput = throughput * srec.attenuation * weight;
+					paths.set_ray(path, scattered);
+				}
+
+				if (bounce >= russian_roulette_depth) {
+					double survival = std::fmin(1.0, std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+					if (random_double() >= survival) {
+						RT_COUNT(paths_ended_by_roulette);
+						continue;
+					}
+					throughput /= survival;
+				}
+				live.push_back(path);
+			}
+		}
+#ifdef RT_ENABLE_COUNTERS
+		thread_counters().paths_ended_by_depth += live.size();
+#endif
+
+		// Added in path order, which is sample order, so the sums match render_tile's exactly
+		for (int path = 0; path < int(paths.size()); path++) {
+			int i = paths.pixels[path] % image_width;
+			int j = paths.pixels[path] / image_width;
+			double luminance = accumulation_buffer::luminance(paths.radiances[path]);
+			accumulation.sum(i, j) += paths.radiances[path];
+			accumulation.luminance_square_sum(i, j) += luminance * luminance;
+		}
+	}
+
 	colour ray_colour(const ray& r, int depth, const hittable& world, const hittable& lights, bool hasLights) const {
 		// If we've exceeded the ray bounce limit, no more light is gathered
-		if (depth <= 0)
+		if (depth <= 0) {
+			RT_COUNT(paths_ended_by_depth);
 			return colour(0, 0, 0);
+		}
+
+		// Every bounce draws from its own stream, so the result doesn't depend on how many numbers earlier bounces used
+		seed_bounce(max_depth - depth + 1);
+		thread_rays++;
+		RT_COUNT(total_rays);
 		
 		hit_record rec;
 		// If the ray hits nothing, return the background colour
 		if (!world.hit(r, interval(0.001, infinity), rec)) {
-			vec3 unit_direction = unit_vector(r.direction());
-			double a = 0.5 * (unit_direction.y() + 1.0);
-			// Linear interpolation between background bottom and top
-			return (1.0 - a) * background_bottom + a * background_top;
+			RT_COUNT(paths_ended_by_miss);
+			return background(r);
 		}
 
 		scatter_record srec;
 		colour emission_colour = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+		RT_COUNT(scatter_calls[rec.mat_ptr->type()]);
 		if (!rec.mat_ptr->scatter(r, rec, srec)) {
+			RT_COUNT(paths_ended_by_emission);
 			return emission_colour;
 		}
 
@@ -178,6 +502,81 @@ private:
 
 		return emission_colour + scatter_colour;
 	}
+
+	colour ray_colour_iterative(const ray& camera_ray, const hittable& world, const hittable& lights, bool hasLights) const {
+		// Same light transport as ray_colour, but as a loop: the radiance gathered so far and the throughput (the product of every attenuation * pdf weight so far) are carried along the path
+		// After russian_roulette_depth bounces, paths survive with a probability given by their throughput, and survivors are weighted up to keep the estimate unbiased
+		colour radiance(0, 0, 0);
+		colour throughput(1, 1, 1);
+		ray r = camera_ray;
+
+		for (int bounce = 1; bounce <= max_depth; bounce++) {
+			// Every bounce draws from its own stream, the same one ray_colour uses for it
+			seed_bounce(bounce);
+			thread_rays++;
+			RT_COUNT(total_rays);
+
+			hit_record rec;
+			if (!world.hit(r, interval(0.001, infinity), rec)) {
+				RT_COUNT(paths_ended_by_miss);
+				return radiance + throughput * background(r);
+			}
+
+			scatter_record srec;
+			radiance += throughput * rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+			RT_COUNT(scatter_calls[rec.mat_ptr->type()]);
+			if (!rec.mat_ptr->scatter(r, rec, srec)) {
+				RT_COUNT(paths_ended_by_emission);
+				return radiance;
+			}
+
+			if (srec.skip_pdf) {
+				throughput = throughput * srec.attenuation;
+				r = srec.skip_pdf_ray;
+			}
+			else {
+				ray scattered;
+				double weight = sample_scatter(r, rec, srec, lights, hasLights, scattered);
+				throughput = throughput * srec.attenuation * weight;
+				r = scattered;
+			}
+
+			if (bounce >= russian_roulette_depth) {
+				double survival = std::fmin(1.0, std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+				if (random_double() >= survival) {
+					RT_COUNT(paths_ended_by_roulette);
+					return radiance;
+				}
+				throughput /= survival;
+			}
+		}
+
+		RT_COUNT(paths_ended_by_depth);
+		return radiance;
+	}
+
+	double sample_scatter(const ray& r, const hit_record& rec, const scatter_record& srec, const hittable& lights, bool hasLights, ray& scattered) const {
+		// Picks the scattered ray from the material's pdf (mixed with the lights' pdf if there are any), and returns its weight scattering_pdf / pdf
+		double pdf_value;
+		if (hasLights) {
+			shared_ptr<hittable_pdf> light_ptr = make_shared<hittable_pdf>(lights, rec.p);
+			mixture_pdf p(light_ptr, srec.pdf_ptr);
+			scattered = ray(rec.p, p.generate(), r.time());
+			pdf_value = p.value(scattered.direction());
+		}
+		else {
+			scattered = ray(rec.p, srec.pdf_ptr->generate(), r.time());
+			pdf_value = srec.pdf_ptr->value(scattered.direction());
+		}
+		return rec.mat_ptr->scattering_pdf(r, rec, scattered) / pdf_value;
+	}
+
+	colour background(const ray& r) const {
+		vec3 unit_direction = unit_vector(r.direction());
+		double a = 0.5 * (unit_direction.y() + 1.0);
+		// Linear interpolation between background bottom and top
+		return (1.0 - a) * background_bottom + a * background_top;
+	}
 };
 
 #endif
\ No newline at end of file
@@ -12,7 +12,7 @@ inline double linear_to_gamma(double linear_component) {
 	return 0;
 }
 
-void write_colour(std::ostream& out, const colour& pixel_colour) {
+inline void colour_to_bytes(const colour& pixel_colour, unsigned char* bytes) {
 	double r = pixel_colour.x();
 	double g = pixel_colour.y();
 	double b = pixel_colour.z();
@@ -29,12 +29,17 @@ void write_colour(std::ostream& out, const colour& pixel_colour) {
 
 	// Translate the [0, 1] component values to the byte range [0, 255]
 	static const interval intensity(0.000, 0.999);
-	int rbyte = int(256 * intensity.clamp(r));
-	int gbyte = int(256 * intensity.clamp(g));
-	int bbyte = int(256 * intensity.clamp(b));
+	bytes[0] = (unsigned char)(256 * intensity.clamp(r));
+	bytes[1] = (unsigned char)(256 * intensity.clamp(g));
+	bytes[2] = (unsigned char)(256 * intensity.clamp(b));
+}
+
+inline void write_colour(std::ostream& out, const colour& pixel_colour) {
+	unsigned char bytes[3];
+	colour_to_bytes(pixel_colour, bytes);
 
-	// Write out the pixel colour components
-	out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+	// Write out the pixel colour components as text (P3)
+	out << int(bytes[0]) << ' ' << int(bytes[1]) << ' ' << int(bytes[2]) << '\n';
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <mutex>
+#include <ostream>
+
+// Hot path counters for finding out where render time goes
+// Each thread counts into its own thread_local copy, which camera::render merges into the totals once the thread is done
+// Unless RT_ENABLE_COUNTERS is defined, RT_COUNT compiles to nothing so the hot paths pay nothing for it
+
+enum primitive_type {
+	primitive_sphere,
+	primitive_quad,
+	primitive_triangle,
+	primitive_ellipse,
+	primitive_annulus,
+	primitive_texture_quad,
+	primitive_constant_medium,
+	primitive_box,
+	primitive_type_count
+};
+
+enum material_type {
+	material_lambertian,
+	material_metal,
+	material_dielectric,
+	material_diffuse_light,
+	material_isotropic,
+	material_other,
+	material_type_count
+};
+
+struct render_counters {
+	long long camera_rays = 0;
+	long long total_rays = 0; // Every ray traced into the world, camera rays included
+	long long box_tests = 0; // aabb::hit calls
+	long long bvh_node_visits = 0;
+	long long primitive_tests[primitive_type_count] = {}; // hit() calls by primitive type
+	long long scatter_calls[material_type_count] = {}; // scatter() calls by material type
+	long long paths_ended_by_depth = 0;
+	long long paths_ended_by_miss = 0;
+	long long paths_ended_by_emission = 0; // Hit a material that doesn't scatter
+	long long paths_ended_by_roulette = 0;
+
+	void merge(const render_counters& other) {
+		camera_rays += other.camera_rays;
+		total_rays += other.total_rays;
+		box_tests += other.box_tests;
+		bvh_node_visits += other.bvh_node_visits;
+		for (int t = 0; t < primitive_type_count; t++)
+			primitive_tests[t] += other.primitive_tests[t];
+		for (int t = 0; t < material_type_count; t++)
+			scatter_calls[t] += other.scatter_calls[t];
+		paths_ended_by_depth += other.paths_ended_by_depth;
+		paths_ended_by_miss += other.paths_ended_by_miss;
+		paths_ended_by_emission += other.paths_ended_by_emission;
+		paths_ended_by_roulette += other.paths_ended_by_roulette;
+	}
+
+	void print(std::ostream& out) const {
+		static const char* primitive_names[primitive_type_count] = { "sphere", "quad", "triangle", "ellipse", "annulus", "texture_quad", "constant_medium", "box" };
+		static const char* material_names[material_type_count] = { "lambertian", "metal", "dielectric", "diffuse_light", "isotropic", "other" };
+
+		out << "Camera rays: " << camera_rays << "\n";
+		out << "Total rays: " << total_rays << "\n";
+		out << "Box tests: " << box_tests << "\n";
+		out << "BVH node visits: " << bvh_node_visits << "\n";
+		for (int t = 0; t < primitive_type_count; t++)
+			if (primitive_tests[t] > 0)
+				out << "Primitive tests (" << primitive_names[t] << "): " << primitive_tests[t] << "\n";
+		for (int t = 0; t < material_type_count; t++)
+			if (scatter_calls[t] > 0)
+				out << "Scatter calls (" << material_names[t] << "): " << scatter_calls[t] << "\n";
+		out << "Paths ended by depth: " << paths_ended_by_depth << "\n";
+		out << "Paths ended by miss: " << paths_ended_by_miss << "\n";
+		out << "Paths ended by emission: " << paths_ended_by_emission << "\n";
+		out << "Paths ended by Russian roulette: " << paths_ended_by_roulette << "\n";
+	}
+};
+
+inline render_counters& thread_counters() {
+	thread_local render_counters counters;
+	return counters;
+}
+
+inline render_counters& total_counters() {
+	static render_counters counters;
+	return counters;
+}
+
+inline void merge_thread_counters() {
+	// Adds this thread's counts to the totals and starts it over from zero
+	static std::mutex merge_lock;
+	std::lock_guard<std::mutex> guard(merge_lock);
+	total_counters().merge(thread_counters());
+	thread_counters() = render_counters();
+}
+
+#ifdef RT_ENABLE_COUNTERS
+#define RT_COUNT(counter) (thread_counters().counter++)
+#else
+#define RT_COUNT(counter) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "external/stb_image_write.h"
+
+#include <cctype>
+#include <string>
+#include <vector>
+
+// Linear (gamma = 1) floating point image the camera renders into
+// It is only encoded once the render is finished, as binary PPM (P6), PNG or Radiance HDR
+class framebuffer {
+public:
+	framebuffer() {}
+	framebuffer(int width, int height) : image_width(width), image_height(height), pixels(size_t(width) * height * 3, 0.0f) {}
+
+	int width() const { return image_width; }
+	int height() const { return image_height; }
+
+	void set(int i, int j, const colour& pixel_colour) {
+		float* pixel = &pixels[(size_t(j) * image_width + i) * 3];
+		pixel[0] = float(pixel_colour.x());
+		pixel[1] = float(pixel_colour.y());
+		pixel[2] = float(pixel_colour.z());
+	}
+
+	colour get(int i, int j) const {
+		const float* pixel = &pixels[(size_t(j) * image_width + i) * 3];
+		return colour(pixel[0], pixel[1], pixel[2]);
+	}
+
+	bool write(std::ostream& out, const std::string& filename) const {
+		// Chooses the encoding from the extension of the output file name, anything unknown is written as PPM
+		std::string extension = filename.substr(filename.find_last_of('.') + 1);
+		for (char& c : extension)
+			c = char(std::tolower(c));
+
+		if (extension == "png")
+			return write_png(out);
+		if (extension == "hdr")
+			return write_hdr(out);
+		return write_ppm(out);
+	}
+
+	bool write_ppm(std::ostream& out) const {
+		// Binary PPM: the same header as P3, followed by the raw RGB bytes
+		std::vector<unsigned char> bytes = to_bytes();
+		out << "P6\n" << image_width << ' ' << image_height << "\n255\n";
+		out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		return out.good();
+	}
+
+	bool write_png(std::ostream& out) const {
+		std::vector<unsigned char> bytes = to_bytes();
+		return stbi_write_png_to_func(write_to_stream, &out, image_width, image_height, 3, bytes.data(), image_width * 3) != 0;
+	}
+
+	bool write_hdr(std::ostream& out) const {
+		// HDR keeps the linear values, only NaNs are removed
+		std::vector<float> linear = pixels;
+		for (float& component : linear)
+			if (component != component) component = 0.0f;
+		return stbi_write_hdr_to_func(write_to_stream, &out, image_width, image_height, 3, linear.data()) != 0;
+	}
+private:
+	int image_width = 0;
+	int image_height = 0;
+	std::vector<float> pixels; // RGB triples, left to right, top to bottom
+
+	std::vector<unsigned char> to_bytes() const {
+		// Gamma corrected 8-bit RGB, using the same conversion as write_colour
+		std::vector<unsigned char> bytes(pixels.size());
+		for (size_t p = 0; p < pixels.size(); p += 3)
+			colour_to_bytes(colour(pixels[p], pixels[p + 1], pixels[p + 2]), &bytes[p]);
+		return bytes;
+	}
+
+	static void write_to_stream(void* context, void* data, int size) {
+		static_cast<std::ostream*>(context)->write(static_cast<const char*>(data), size);
+	}
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only view of a whole file mapped into memory, pages are only read from disk when they are touched
+// Anything pointing into data() has to keep the mapped_file alive, e.g. through a shared_ptr
+class mapped_file {
+public:
+	mapped_file(const char path[]) {
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size))
+			return;
+		opened = true;
+		length = size_t(file_size.QuadPart);
+		if (length == 0)
+			return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+			bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		descriptor = open(path, O_RDONLY);
+		if (descriptor < 0)
+			return;
+		struct stat status;
+		if (fstat(descriptor, &status) != 0)
+			return;
+		opened = true;
+		length = size_t(status.st_size);
+		if (length == 0)
+			return;
+		void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (address != MAP_FAILED)
+			bytes = static_cast<const char*>(address);
+#endif
+		if (bytes == nullptr) {
+			opened = false;
+			length = 0;
+		}
+	}
+
+	~mapped_file() {
+#ifdef _WIN32
+		if (bytes != nullptr)
+			UnmapViewOfFile(bytes);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (bytes != nullptr)
+			munmap(const_cast<char*>(bytes), length);
+		if (descriptor >= 0)
+			close(descriptor);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool is_open() const { return opened; } // An empty file is open, with no data
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+private:
+	bool opened = false;
+	const char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int descriptor = -1;
+#endif
+};
+
+#endif
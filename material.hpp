@@ -28,6 +28,10 @@ public:
 	virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
 		return 0;
 	}
+
+	virtual material_type type() const {
+		return material_other;
+	}
 };
 /*
 class uniform : public material {
@@ -58,6 +62,8 @@ public:
 	lambertian(const colour& albedo) : tex(make_shared<solid_colour>(albedo)) {}
 	lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
+	material_type type() const override { return material_lambertian; }
+
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
 		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
 		srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
@@ -102,6 +108,8 @@ class metal : public material {
 public:
 	metal(const colour& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
+	material_type type() const override { return material_metal; }
+
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
 		vec3 reflected = reflect(r_in.direction(), rec.normal);
 		reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
@@ -137,6 +145,8 @@ class dielectric : public material {
 public:
 	dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
+	material_type type() const override { return material_dielectric; }
+
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
 		srec.attenuation = colour(1.0, 1.0, 1.0);
 		srec.pdf_ptr = nullptr;
@@ -183,6 +193,8 @@ public:
 	diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
 	diffuse_light(const colour& emit) : tex(make_shared<solid_colour>(emit)) {}
 
+	material_type type() const override { return material_diffuse_light; }
+
 	colour emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override {
 		if (!rec.front_face)
 			return colour(0, 0, 0);
@@ -197,6 +209,8 @@ public:
 	isotropic(const colour& albedo) : tex(make_shared<solid_colour>(albedo)) {}
 	isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
+	material_type type() const override { return material_isotropic; }
+
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
 		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
 		srec.pdf_ptr = make_shared<sphere_pdf>();
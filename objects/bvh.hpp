@@ -2,75 +2,250 @@
 #define BVH_H
 
 #include "aabb.hpp"
+#include "bvh_tree.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "wide_bvh.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <span>
 
-class bvh_node : public hittable {
+// A hittable with its own hierarchy inside (bvh_node, linear_bvh, triangle_mesh), so its traversal cost can be folded into the hierarchy above it
+class bvh_hittable : public hittable {
 public:
-	bvh_node(hittable_list list) : bvh_node(list.objects) {
+	virtual double traversal_cost() const = 0;
+};
+
+// Pointer based hierarchy, every node is a hittable with shared_ptr children
+// Scenes use make_bvh, which builds the flattened linear_bvh instead
+class bvh_node : public bvh_hittable {
+public:
+	static inline double total_build_seconds = 0; // Time spent building hierarchies from hittable lists, for benchmarking
+	static inline bvh_builder builder = bvh_sah; // Builder used by every BVH constructed from now on, bvh_node or linear_bvh
+
+	bvh_node(hittable_list list) {
 		// The constructor (without span indices) creates an implicit copy of the hittable list, which we will modify
 		// The lifetime of the copied list only extends until this constructor exits
 		// We only need to persist the resulting bounding volume hierachy, so this is ok
+		auto start_time = std::chrono::steady_clock::now();
+		build(list.objects, 0, list.objects.size());
+		total_build_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+		// Builds over the span objects[start, end), which is reordered in place instead of being copied at every level
+		build(objects, start, end);
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		return hit(r, slab_ray(r), ray_t, rec);
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override {
+		return occluded(r, slab_ray(r), ray_t);
+	}
+
+	aabb bounding_box() const override {
+		return bbox;
+	}
+
+	double traversal_cost() const override {
+		// Expected cost of a ray that enters the root box, in units of one object intersection, weighing each node by the chance (its surface area relative to the root's) that the ray enters it
+		return cost;
+	}
+
+	static double hittable_cost(const shared_ptr<hittable>& object);
+
+private:
+	static constexpr int sah_bins = 16;
+	static constexpr int max_leaf_objects = 8;
+	static constexpr double node_traversal_cost = 0.125; // Relative to one object intersection
+
+	shared_ptr<hittable> left;
+	shared_ptr<hittable> right;
+	std::vector<shared_ptr<hittable>> leaf_objects; // Only SAH leaves use this, instead of left / right
+	aabb bbox;
+	double cost = 0; // See traversal_cost
+	bool children_are_nodes = false; // Whether left / right are bvh_nodes, which are then walked with the slab_ray of the root
+
+	bool hit(const ray& r, const slab_ray& slabs, interval ray_t, hit_record& rec) const {
+		RT_COUNT(bvh_node_visits);
+		if (!bbox.hit(slabs, ray_t)) // If it didn't hit the box, it didn't hit any children
+			return false;
+
+		if (!leaf_objects.empty()) {
+			bool hit_anything = false;
+			for (const shared_ptr<hittable>& object : leaf_objects) {
+				if (object->hit(r, ray_t, rec)) {
+					hit_anything = true;
+					ray_t.max = rec.t;
+				}
+			}
+			return hit_anything;
+		}
+
+		if (children_are_nodes) {
+			bool hit_left = static_cast<const bvh_node*>(left.get())->hit(r, slabs, ray_t, rec);
+			bool hit_right = static_cast<const bvh_node*>(right.get())->hit(r, slabs, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+			return hit_left || hit_right;
+		}
+
+		bool hit_left = left->hit(r, ray_t, rec);
+		bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+		return hit_left || hit_right;
 	}
 
-	bvh_node(std::vector<shared_ptr<hittable>>& src_objects) {
+	bool occluded(const ray& r, const slab_ray& slabs, interval ray_t) const {
+		RT_COUNT(bvh_node_visits);
+		if (!bbox.hit(slabs, ray_t))
+			return false;
+
+		if (!leaf_objects.empty()) {
+			for (const shared_ptr<hittable>& object : leaf_objects)
+				if (object->occluded(r, ray_t))
+					return true;
+			return false;
+		}
+		if (children_are_nodes)
+			return static_cast<const bvh_node*>(left.get())->occluded(r, slabs, ray_t) || static_cast<const bvh_node*>(right.get())->occluded(r, slabs, ray_t);
+		return left->occluded(r, ray_t) || right->occluded(r, ray_t);
+	}
+
+	void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
 		// Build the bounding box of the span of source objects
 		bbox = aabb::empty;
 
-		size_t size = src_objects.size();
+		size_t size = end - start;
+
+		for (size_t object_index = start; object_index < end; object_index++)
+			bbox = aabb(bbox, objects[object_index]->bounding_box());
 
-		for (size_t object_index = 0; object_index < size; object_index++)
-			bbox = aabb(bbox, src_objects[object_index]->bounding_box());
+		// Every object has exactly one node here, so bvh_sbvh builds it with plain SAH
+		if (builder != bvh_median && build_sah(objects, start, end))
+			return;
 
 		int axis = bbox.longest_axis();
 
 		auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
-		
-		auto objects = src_objects; // A modifiable array of the source scene objects
 
 		if (size == 1) {
-			left = right = objects[0];
+			left = right = objects[start];
 		} else if (size == 2) {
-			if (comparator(objects[0], objects[1])) {
-				left = objects[0];
-				right = objects[1];
+			if (comparator(objects[start], objects[start + 1])) {
+				left = objects[start];
+				right = objects[start + 1];
 			} else {
-				left = objects[1];
-				right = objects[0];
+				left = objects[start + 1];
+				right = objects[start];
 			}
 		} else {
-			auto mid = size / 2;
+			auto mid = start + size / 2;
 
-			std::nth_element(objects.begin(), objects.begin() + mid, objects.end(), comparator);
+			std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end, comparator);
 
-			auto objects_left = std::vector<std::shared_ptr<hittable>>(objects.begin(), objects.begin() + mid);
-			auto objects_right = std::vector<std::shared_ptr<hittable>>(objects.begin() + mid, objects.end());
-
-			left = make_shared<bvh_node>(objects_left);
-			right = make_shared<bvh_node>(objects_right);
+			left = make_shared<bvh_node>(objects, start, mid);
+			right = make_shared<bvh_node>(objects, mid, end);
+			children_are_nodes = true;
 		}
+		cost = node_traversal_cost + child_cost(left) + child_cost(right);
 	}
 
-	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-		if (!bbox.hit(r, ray_t)) // If it didn't hit the box, it didn't hit any children
-			return false;
+	bool build_sah(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+		// Bins the object centroids along each axis and evaluates the SAH cost of splitting between every pair of bins, against the cost of a leaf
+		// Returns false, leaving it to the median split, when all centroids coincide but there are too many objects for one leaf
+		size_t size = end - start;
+		double leaf_cost = double(size);
 
-		bool hit_left = left->hit(r, ray_t, rec);
-		bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+		aabb centroid_bounds = aabb::empty;
+		for (size_t object_index = start; object_index < end; object_index++)
+			centroid_bounds = aabb(centroid_bounds, aabb(centroid(objects[object_index]), centroid(objects[object_index])));
 
-		return hit_left || hit_right;
+		int best_axis = -1;
+		int best_split = 0;
+		double best_cost = infinity;
+		double parent_area = bbox.surface_area();
+		for (int axis = 0; axis < 3 && size > 1; axis++) {
+			const interval& extent = centroid_bounds.axis_interval(axis);
+			if (extent.size() <= 0)
+				continue;
+
+			int counts[sah_bins] = {};
+			aabb bounds[sah_bins];
+			for (int b = 0; b < sah_bins; b++)
+				bounds[b] = aabb::empty;
+			for (size_t object_index = start; object_index < end; object_index++) {
+				int b = bin_index(objects[object_index], axis, extent);
+				counts[b]++;
+				bounds[b] = aabb(bounds[b], objects[object_index]->bounding_box());
+			}
+
+			// Sweep from the right first, so the left sweep can evaluate every split as it goes
+			double right_areas[sah_bins];
+			int right_counts[sah_bins];
+			aabb right_box = aabb::empty;
+			int right_count = 0;
+			for (int b = sah_bins - 1; b > 0; b--) {
+				right_box = aabb(right_box, bounds[b]);
+				right_count += counts[b];
+				right_areas[b] = right_box.surface_area();
+				right_counts[b] = right_count;
+			}
+
+			aabb left_box = aabb::empty;
+			int left_count = 0;
+			for (int split = 1; split < sah_bins; split++) {
+				left_box = aabb(left_box, bounds[split - 1]);
+				left_count += counts[split - 1];
+				if (left_count == 0 || right_counts[split] == 0)
+					continue;
+				double split_cost = node_traversal_cost + (left_box.surface_area() * left_count + right_areas[split] * right_counts[split]) / parent_area;
+				if (split_cost < best_cost) {
+					best_cost = split_cost;
+					best_axis = axis;
+					best_split = split;
+				}
+			}
+		}
+
+		if (best_axis < 0 || (leaf_cost <= best_cost && size <= max_leaf_objects)) {
+			if (best_axis < 0 && size > max_leaf_objects)
+				return false;
+			leaf_objects.assign(objects.begin() + start, objects.begin() + end);
+			cost = node_traversal_cost + leaf_cost;
+			return true;
+		}
+
+		const interval& extent = centroid_bounds.axis_interval(best_axis);
+		auto mid = std::partition(objects.begin() + start, objects.begin() + end, [&](const shared_ptr<hittable>& object) {
+			return bin_index(object, best_axis, extent) < best_split;
+		});
+
+		left = make_shared<bvh_node>(objects, start, size_t(mid - objects.begin()));
+		right = make_shared<bvh_node>(objects, size_t(mid - objects.begin()), end);
+		children_are_nodes = true;
+		cost = node_traversal_cost + child_cost(left) + child_cost(right);
+		return true;
 	}
 
-	aabb bounding_box() const override {
-		return bbox;
+	double child_cost(const shared_ptr<hittable>& child) const {
+		// A child's cost, weighted by the chance that a ray entering this node also enters the child
+		double area = bbox.surface_area();
+		double weight = area > 0 ? child->bounding_box().surface_area() / area : 1.0;
+		return weight * hittable_cost(child);
 	}
 
-private:
-	shared_ptr<hittable> left;
-	shared_ptr<hittable> right;
-	aabb bbox;
+	static point3 centroid(const shared_ptr<hittable>& object) {
+		aabb box = object->bounding_box();
+		return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+	}
+
+	static int bin_index(const shared_ptr<hittable>& object, int axis, const interval& extent) {
+		int b = int(sah_bins * (centroid(object)[axis] - extent.min) / extent.size());
+		return std::clamp(b, 0, sah_bins - 1);
+	}
 
 	static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index) {
 		interval a_axis_interval = a->bounding_box().axis_interval(axis_index);
@@ -91,4 +266,162 @@ private:
 	}
 };
 
+// Flattened hierarchy over a list of primitive boxes: a bvh_tree, collapsed into a wide_bvh_tree when the branching factor is 4 or 8
+// Its owner stores the primitives in primitive_indices() order and intersects them through the callback given to traverse
+class bvh_hierarchy {
+public:
+	static inline int branching = 4; // Children per node: 2, 4 (SSE) or 8 (AVX2)
+
+	bvh_hierarchy() {}
+
+	bvh_hierarchy(const std::vector<aabb>& boxes, const std::vector<double>& primitive_costs = {}, bvh_builder builder = bvh_node::builder, bvh_tree::clip_function clip_primitive = {}) {
+		auto start_time = std::chrono::steady_clock::now();
+		tree = bvh_tree(boxes, builder, primitive_costs, std::move(clip_primitive));
+		collapse();
+		bvh_node::total_build_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	bvh_hierarchy(const std::vector<aabb>& start_boxes, const std::vector<aabb>& end_boxes, const std::vector<double>& primitive_costs) {
+		// Primitives that move between times 0 and 1: built over their swept boxes, then every node is bounded at both times (see bvh_tree::refit_motion)
+		auto start_time = std::chrono::steady_clock::now();
+		std::vector<aabb> swept_boxes(start_boxes.size());
+		for (size_t index = 0; index < swept_boxes.size(); index++)
+			swept_boxes[index] = aabb(start_boxes[index], end_boxes[index]);
+		tree = bvh_tree(swept_boxes, bvh_node::builder == bvh_sbvh ? bvh_sah : bvh_node::builder, primitive_costs);
+		tree.refit_motion(start_boxes, end_boxes, primitive_costs);
+		collapse();
+		bvh_node::total_build_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	bvh_hierarchy(int node_width, std::span<const std::byte> node_data, const aabb& box, double cost) {
+		// Nodes saved earlier from node_data() of a hierarchy with that node_width (e.g. memory mapped from a cache), they must outlive this
+		if (node_width == 4) {
+			tree = bvh_tree({}, box, cost);
+			tree4 = wide_bvh_tree<4>(std::span(reinterpret_cast<const wide_bvh_node<4>*>(node_data.data()), node_data.size() / sizeof(wide_bvh_node<4>)));
+		}
+		else if (node_width == 8) {
+			tree = bvh_tree({}, box, cost);
+			tree8 = wide_bvh_tree<8>(std::span(reinterpret_cast<const wide_bvh_node<8>*>(node_data.data()), node_data.size() / sizeof(wide_bvh_node<8>)));
+		}
+		else {
+			tree = bvh_tree(std::span(reinterpret_cast<const linear_bvh_node*>(node_data.data()), node_data.size() / sizeof(linear_bvh_node)), box, cost);
+		}
+	}
+
+	int node_width() const { return !tree4.empty() ? 4 : !tree8.empty() ? 8 : 2; }
+
+	std::span<const std::byte> node_data() const {
+		// The nodes that get traversed, as bytes, for saving
+		if (!tree4.empty())
+			return std::as_bytes(tree4.node_array());
+		if (!tree8.empty())
+			return std::as_bytes(tree8.node_array());
+		return std::as_bytes(tree.node_array());
+	}
+
+	const std::vector<uint32_t>& primitive_indices() const { return tree.primitive_indices(); }
+	void release_primitive_indices() { tree.release_primitive_indices(); }
+	aabb bounding_box() const { return tree.bounding_box(); }
+	aabb bounding_box_at(double time) const { return tree.bounding_box_at(time); }
+	double traversal_cost() const { return tree.traversal_cost(); }
+
+	template <bool any_hit = false, typename hit_function>
+	bool traverse(const ray& r, interval& ray_t, hit_function&& hit_primitive) const {
+		if (!tree4.empty())
+			return tree4.traverse<any_hit>(r, ray_t, hit_primitive);
+		if (!tree8.empty())
+			return tree8.traverse<any_hit>(r, ray_t, hit_primitive);
+		return tree.traverse<any_hit>(r, ray_t, hit_primitive);
+	}
+private:
+	bvh_tree tree;
+	wide_bvh_tree<4> tree4;
+	wide_bvh_tree<8> tree8;
+
+	void collapse() {
+		if (branching == 4)
+			tree4 = wide_bvh_tree<4>(tree);
+		else if (branching == 8)
+			tree8 = wide_bvh_tree<8>(tree);
+		// Only the wide tree is traversed once it exists
+		if (branching == 4 || branching == 8)
+			tree.release_nodes();
+	}
+};
+
+// Hittable over a bvh_hierarchy, the objects are kept in one array in the tree's leaf order
+class linear_bvh : public bvh_hittable {
+public:
+	linear_bvh(const hittable_list& list) {
+		std::vector<aabb> boxes(list.objects.size());
+		std::vector<aabb> start_boxes(list.objects.size());
+		std::vector<aabb> end_boxes(list.objects.size());
+		std::vector<double> costs(list.objects.size());
+		bool moving = false;
+		for (size_t index = 0; index < boxes.size(); index++) {
+			boxes[index] = list.objects[index]->bounding_box();
+			start_boxes[index] = list.objects[index]->bounding_box_at(0);
+			end_boxes[index] = list.objects[index]->bounding_box_at(1);
+			costs[index] = bvh_node::hittable_cost(list.objects[index]);
+			moving = moving || !same_box(start_boxes[index], end_boxes[index]);
+		}
+
+		// A spatial split would make some objects hit twice per ray, which volumes can't take (every hit picks a new random distance)
+		if (moving)
+			hierarchy = bvh_hierarchy(start_boxes, end_boxes, costs);
+		else
+			hierarchy = bvh_hierarchy(boxes, costs, bvh_node::builder == bvh_sbvh ? bvh_sah : bvh_node::builder);
+		objects.reserve(boxes.size());
+		for (uint32_t index : hierarchy.primitive_indices())
+			objects.push_back(list.objects[index]);
+		hierarchy.release_primitive_indices();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		return hierarchy.traverse(r, ray_t, [&](uint32_t position, interval& t) {
+			if (!objects[position]->hit(r, t, rec))
+				return false;
+			t.max = rec.t;
+			return true;
+		});
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override {
+		return hierarchy.traverse<true>(r, ray_t, [&](uint32_t position, interval& t) {
+			return objects[position]->occluded(r, t);
+		});
+	}
+
+	aabb bounding_box() const override {
+		return hierarchy.bounding_box();
+	}
+
+	aabb bounding_box_at(double time) const override {
+		return hierarchy.bounding_box_at(time);
+	}
+
+	double traversal_cost() const override {
+		return hierarchy.traversal_cost();
+	}
+private:
+	bvh_hierarchy hierarchy;
+	std::vector<shared_ptr<hittable>> objects; // In the tree's leaf order
+
+	static bool same_box(const aabb& a, const aabb& b) {
+		return a.x.min == b.x.min && a.x.max == b.x.max && a.y.min == b.y.min && a.y.max == b.y.max && a.z.min == b.z.min && a.z.max == b.z.max;
+	}
+};
+
+inline double bvh_node::hittable_cost(const shared_ptr<hittable>& object) {
+	// Traversal cost of a nested hierarchy, any other object counts as one intersection
+	if (const bvh_hittable* nested = dynamic_cast<const bvh_hittable*>(object.get()))
+		return nested->traversal_cost();
+	return 1.0;
+}
+
+inline shared_ptr<hittable> make_bvh(const hittable_list& list) {
+	// The hierarchy scenes and models are built with
+	return make_shared<linear_bvh>(list);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,728 @@
+#ifndef BVH_TREE_H
+#define BVH_TREE_H
+
+#include "aabb.hpp"
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+// How a BVH picks the split of each node
+enum bvh_builder {
+	bvh_median, // Halves the objects at the median of the longest axis
+	bvh_sah, // Binned surface area heuristic, leaves may hold several objects
+	bvh_sbvh // SAH that may also split space, putting a primitive that straddles the plane in both children (see bvh_tree::spatial_split_budget)
+};
+
+inline const char* bvh_builder_name(bvh_builder builder) {
+	return builder == bvh_median ? "median" : builder == bvh_sbvh ? "sbvh" : "sah";
+}
+
+// One node of a flattened BVH, 32 bytes so two fit in a cache line
+// Nodes are stored depth first, so an interior node's first child is the next node and only the second child's index is kept
+struct linear_bvh_node {
+	float box_min[3]; // Rounded outwards from the double precision box, so the float box never misses a hit
+	float box_max[3];
+	uint32_t offset; // Leaves: the first entry of their primitive indices, interior nodes: the second child
+	uint16_t count; // Number of primitives in a leaf, 0 for interior nodes
+	uint8_t axis; // Split axis of an interior node, picks which child a ray visits first
+	uint8_t pad;
+};
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be 32 bytes");
+
+// How a linear_bvh_node's box moves over the shutter: the node holds the box at time 0 and box + delta is the box at time 1
+// Kept beside the nodes, so hierarchies without moving primitives don't pay for it
+struct linear_bvh_motion {
+	float delta_min[3];
+	float delta_max[3];
+};
+
+// Flattened bounding volume hierarchy over a list of primitive boxes
+// Only knows about boxes and indices, whoever owns the primitives intersects them through the callback given to traverse
+class bvh_tree {
+public:
+	static inline int build_threads = 0; // Threads building large trees, 0 means every hardware thread
+	static inline double spatial_split_budget = 0.3; // bvh_sbvh only: how many extra primitive references spatial splits may add, as a fraction of the primitives
+
+	bvh_tree() {}
+
+	bvh_tree(std::span<const linear_bvh_node> nodes, const aabb& root_box, double cost) : nodes(nodes), root_box(root_box), cost(cost) {
+		// A tree built earlier (e.g. memory mapped from a cache), the nodes must outlive it and the primitives already be in leaf order
+	}
+
+	// The nodes may live in node_storage, so a copy would point into the original's
+	bvh_tree(const bvh_tree&) = delete;
+	bvh_tree& operator=(const bvh_tree&) = delete;
+	bvh_tree(bvh_tree&&) = default;
+	bvh_tree& operator=(bvh_tree&&) = default;
+
+	// Box of the part of a primitive between two planes along an axis (empty if it has none), lets spatial splits clip the primitive itself
+	using clip_function = std::function<aabb(uint32_t index, int axis, double min, double max)>;
+
+	bvh_tree(const std::vector<aabb>& boxes, bvh_builder builder, const std::vector<double>& primitive_costs = {}, clip_function clip_primitive = {})
+		: builder(builder), primitive_costs(primitive_costs), clip_primitive(std::move(clip_primitive)) {
+		// primitive_costs only feeds traversal_cost (e.g. a nested BVH costs more than one intersection), every primitive counts as 1 if it's empty
+		// Without clip_primitive, spatial splits clip the primitives' boxes, which only tightens them along the split axis
+		if (!boxes.empty() && builder == bvh_sbvh) {
+			// Serial, the references of a node are copied into its children so there is no range to hand to another thread
+			std::vector<reference> references(boxes.size());
+			for (uint32_t index = 0; index < boxes.size(); index++)
+				references[index] = { boxes[index], index };
+			size_t spare_references = size_t(spatial_split_budget * double(boxes.size()));
+			indices.reserve(boxes.size() + spare_references);
+
+			subtree tree;
+			tree.nodes.reserve(boxes.size() * 2);
+			tree.costs.reserve(boxes.size() * 2);
+			aabb scene_box = aabb::empty;
+			for (const aabb& box : boxes)
+				scene_box = aabb(scene_box, box);
+			root_box = build_spatial(references, tree, spare_references, scene_box.surface_area());
+			node_storage = std::move(tree.nodes);
+			nodes = node_storage;
+			cost = tree.costs[0];
+		}
+		else if (!boxes.empty()) {
+			indices.resize(boxes.size());
+			centroids.resize(boxes.size());
+			for (uint32_t index = 0; index < boxes.size(); index++) {
+				indices[index] = index;
+				centroids[index] = centroid(boxes[index]);
+			}
+
+			int threads = build_threads > 0 ? build_threads : std::max(1, int(std::thread::hardware_concurrency()));
+			std::unique_ptr<task_pool> pool;
+			if (threads > 1 && boxes.size() >= 2 * parallel_subtree_size)
+				pool = std::make_unique<task_pool>(threads);
+
+			subtree tree;
+			tree.nodes.reserve(boxes.size() * 2);
+			tree.costs.reserve(boxes.size() * 2);
+			root_box = build(boxes, 0, uint32_t(boxes.size()), tree, pool.get());
+			node_storage = std::move(tree.nodes);
+			nodes = node_storage;
+			cost = tree.costs[0];
+		}
+		centroids.clear();
+		centroids.shrink_to_fit();
+		this->primitive_costs.clear();
+		this->primitive_costs.shrink_to_fit();
+		this->clip_primitive = {};
+	}
+
+	aabb bounding_box() const { return root_box; }
+	const std::vector<uint32_t>& primitive_indices() const { return indices; } // With bvh_sbvh a primitive may be in several leaves, so appear more than once
+	size_t node_count() const { return nodes.size(); }
+	std::span<const linear_bvh_node> node_array() const { return nodes; }
+
+	std::span<const linear_bvh_motion> motion_array() const { return motion; } // Empty unless refit_motion was called
+
+	void release_nodes() {
+		// For owners that only traverse a wide_bvh_tree collapsed from this one, the box and cost stay available
+		nodes = {};
+		node_storage.clear();
+		node_storage.shrink_to_fit();
+		motion.clear();
+		motion.shrink_to_fit();
+	}
+
+	void refit_motion(const std::vector<aabb>& start_boxes, const std::vector<aabb>& end_boxes, const std::vector<double>& primitive_costs = {}) {
+		// For moving primitives, with their boxes at times 0 and 1: keeps the tree built over their swept boxes but bounds every node at both times
+		// Traversal then tests each node's box interpolated to the ray's time, and traversal_cost uses the boxes' area averaged over the shutter
+		if (node_storage.empty())
+			return;
+		motion.resize(node_storage.size());
+		cost = refit_motion(0, start_boxes, end_boxes, primitive_costs, start_box, end_box);
+	}
+
+	aabb bounding_box_at(double time) const {
+		if (motion.empty())
+			return root_box;
+		return lerp(start_box, end_box, time);
+	}
+
+	void release_primitive_indices() {
+		// For owners that already store their primitives in leaf order
+		indices.clear();
+		indices.shrink_to_fit();
+	}
+
+	double traversal_cost() const {
+		// Expected cost of a ray that enters the root box, in units of one primitive intersection (see bvh_node::traversal_cost)
+		return cost;
+	}
+
+	template <bool any_hit = false, typename hit_function>
+	bool traverse(const ray& r, interval& ray_t, hit_function&& hit_primitive) const {
+		// Walks the tree with an explicit stack, visiting the nearer child first so ray_t shrinks as early as possible
+		// hit_primitive(position, ray_t) intersects the primitive at that position of primitive_indices() and, when it hits, lowers ray_t.max to the hit distance
+		// Owners normally store their primitives in that order, so a leaf's primitives are contiguous in memory
+		// With any_hit the walk stops at the first primitive hit, for occlusion queries
+		if (nodes.empty())
+			return false;
+		if (!motion.empty())
+			return walk<any_hit, true>(r, ray_t, hit_primitive);
+		return walk<any_hit, false>(r, ray_t, hit_primitive);
+	}
+private:
+	static constexpr int sah_bins = 16;
+	static constexpr int max_leaf_primitives = 8;
+	static constexpr double node_traversal_cost = 0.125; // Relative to one primitive intersection
+	static constexpr uint32_t parallel_subtree_size = 4096; // Smaller subtrees aren't worth handing to another thread
+	static constexpr double spatial_split_overlap = 1e-5; // Spatial splits are only tried where the object split's children overlap by more than this fraction of the root's area
+
+	bvh_builder builder = bvh_sah;
+	std::vector<linear_bvh_node> node_storage; // Nodes of a tree built here
+	std::span<const linear_bvh_node> nodes; // node_storage, or nodes owned by someone else
+	std::vector<uint32_t> indices; // Primitive indices in leaf order
+	aabb root_box;
+	double cost = 0;
+	std::vector<linear_bvh_motion> motion; // One per node after refit_motion
+	aabb start_box, end_box; // The root's box at times 0 and 1, after refit_motion
+
+	// Only needed while building
+	std::vector<point3> centroids;
+	std::vector<double> primitive_costs;
+	clip_function clip_primitive;
+
+	struct reference {
+		aabb box; // The primitive's box, clipped to the side of every spatial split above it
+		uint32_t index;
+	};
+
+	struct subtree {
+		std::vector<linear_bvh_node> nodes; // Depth first, like the finished tree
+		std::vector<double> costs; // traversal_cost of every node's subtree
+	};
+
+	template <bool any_hit, bool moving, typename hit_function>
+	bool walk(const ray& r, interval& ray_t, hit_function&& hit_primitive) const {
+		// The loop of traverse, with moving the nodes' boxes are first interpolated to the ray's time
+		const slab_ray slabs(r);
+		uint32_t stack[64];
+		int stack_size = 0;
+		uint32_t current = 0;
+		bool hit_anything = false;
+		const float time = float(r.time());
+		while (true) {
+			const linear_bvh_node& node = nodes[current];
+			RT_COUNT(bvh_node_visits);
+			bool entered;
+			if constexpr (moving)
+				entered = node_hit(at_time(node, motion[current], time), slabs, ray_t);
+			else
+				entered = node_hit(node, slabs, ray_t);
+			if (entered) {
+				if (node.count > 0) {
+					for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+						if (hit_primitive(p, ray_t)) {
+							if constexpr (any_hit)
+								return true;
+							hit_anything = true;
+						}
+					}
+				}
+				else if (slabs.direction_sign(node.axis)) {
+					stack[stack_size++] = current + 1;
+					current = node.offset;
+					continue;
+				}
+				else {
+					stack[stack_size++] = node.offset;
+					current = current + 1;
+					continue;
+				}
+			}
+			if (stack_size == 0)
+				break;
+			current = stack[--stack_size];
+		}
+		return hit_anything;
+	}
+
+	static bool node_hit(const linear_bvh_node& node, const slab_ray& r, interval ray_t) {
+		// Same sign indexed slab test as aabb::hit
+		RT_COUNT(box_tests);
+		const point3& origin = r.origin();
+		const vec3& inv_dir = r.inv_direction();
+		for (int axis = 0; axis < 3; axis++) {
+			const int sign = r.direction_sign(axis);
+			double t_near = ((sign ? node.box_max[axis] : node.box_min[axis]) - origin[axis]) * inv_dir[axis];
+			double t_far = ((sign ? node.box_min[axis] : node.box_max[axis]) - origin[axis]) * inv_dir[axis];
+			ray_t.min = t_near > ray_t.min ? t_near : ray_t.min;
+			ray_t.max = t_far < ray_t.max ? t_far : ray_t.max;
+			if (ray_t.max <= ray_t.min)
+				return false;
+		}
+		return true;
+	}
+
+	aabb build(const std::vector<aabb>& boxes, uint32_t begin, uint32_t end, subtree& out, task_pool* pool) {
+		// Builds the subtree over indices[begin, end) onto the end of out, partitioning that range in place, and returns its box
+		// With a pool, large second children are built on another thread into their own subtree, which is appended once both halves are done
+		// Either way the nodes end up in the same order, so the tree doesn't depend on the thread count
+		uint32_t node_index = uint32_t(out.nodes.size());
+		out.nodes.push_back(linear_bvh_node());
+		out.costs.push_back(0);
+
+		aabb box = aabb::empty;
+		aabb centroid_box = aabb::empty;
+		for (uint32_t p = begin; p < end; p++) {
+			box = aabb(box, boxes[indices[p]]);
+			centroid_box = aabb(centroid_box, aabb(centroids[indices[p]], centroids[indices[p]]));
+		}
+		set_box(out.nodes[node_index], box);
+
+		uint32_t count = end - begin;
+		int axis = 0;
+		uint32_t mid = begin;
+		bool split = builder == bvh_sah ? find_sah_split(boxes, begin, end, box, centroid_box, axis, mid) : count > 2;
+		if (split && builder == bvh_median) {
+			axis = box.longest_axis();
+			mid = begin + count / 2;
+			std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [&](uint32_t a, uint32_t b) {
+				return boxes[a].axis_interval(axis).min < boxes[b].axis_interval(axis).min;
+			});
+		}
+
+		if (!split) {
+			out.nodes[node_index].offset = begin;
+			out.nodes[node_index].count = uint16_t(count);
+			double leaf_cost = primitive_costs.empty() ? double(count) : 0.0;
+			for (uint32_t p = begin; p < end && !primitive_costs.empty(); p++)
+				leaf_cost += primitive_costs[indices[p]];
+			out.costs[node_index] = node_traversal_cost + leaf_cost;
+			return box;
+		}
+
+		uint32_t first_child = uint32_t(out.nodes.size());
+		uint32_t second_child;
+		aabb first_box;
+		aabb second_box;
+		if (pool && end - mid >= parallel_subtree_size) {
+			subtree second;
+			task_pool::task_handle second_done = pool->submit([&]() { second_box = build(boxes, mid, end, second, pool); });
+			first_box = build(boxes, begin, mid, out, pool);
+			pool->wait(second_done);
+			second_child = uint32_t(out.nodes.size());
+			append(out, second);
+		}
+		else {
+			first_box = build(boxes, begin, mid, out, pool);
+			second_child = uint32_t(out.nodes.size());
+			second_box = build(boxes, mid, end, out, pool);
+		}
+
+		set_interior(out, node_index, first_child, second_child, axis, box, first_box, second_box);
+		return box;
+	}
+
+	aabb build_spatial(std::vector<reference>& references, subtree& out, size_t& spare_references, double root_area) {
+		// Like build, but over a list of references that is split into two new lists, leaves append their references to indices
+		uint32_t node_index = uint32_t(out.nodes.size());
+		out.nodes.push_back(linear_bvh_node());
+		out.costs.push_back(0);
+
+		aabb box = aabb::empty;
+		for (const reference& ref : references)
+			box = aabb(box, ref.box);
+		set_box(out.nodes[node_index], box);
+
+		int axis = 0;
+		std::vector<reference> first, second;
+		if (!find_spatial_split(references, box, root_area, spare_references, axis, first, second)) {
+			out.nodes[node_index].offset = uint32_t(indices.size());
+			out.nodes[node_index].count = uint16_t(references.size());
+			double leaf_cost = primitive_costs.empty() ? double(references.size()) : 0.0;
+			for (const reference& ref : references) {
+				indices.push_back(ref.index);
+				if (!primitive_costs.empty())
+					leaf_cost += primitive_costs[ref.index];
+			}
+			out.costs[node_index] = node_traversal_cost + leaf_cost;
+			return box;
+		}
+		references.clear();
+		references.shrink_to_fit();
+
+		uint32_t first_child = uint32_t(out.nodes.size());
+		aabb first_box = build_spatial(first, out, spare_references, root_area);
+		uint32_t second_child = uint32_t(out.nodes.size());
+		aabb second_box = build_spatial(second, out, spare_references, root_area);
+		set_interior(out, node_index, first_child, second_child, axis, box, first_box, second_box);
+		return box;
+	}
+
+	static void set_interior(subtree& out, uint32_t node_index, uint32_t first_child, uint32_t second_child, int axis, const aabb& box, const aabb& first_box, const aabb& second_box) {
+		out.nodes[node_index].offset = second_child;
+		out.nodes[node_index].axis = uint8_t(axis);
+		double area = box.surface_area();
+		double first_weight = area > 0 ? first_box.surface_area() / area : 1.0;
+		double second_weight = area > 0 ? second_box.surface_area() / area : 1.0;
+		out.costs[node_index] = node_traversal_cost + first_weight * out.costs[first_child] + second_weight * out.costs[second_child];
+	}
+
+	static void append(subtree& out, const subtree& second) {
+		// Interior nodes point at their second child by index, which moves with the subtree, leaves point into the shared index array and stay put
+		uint32_t base = uint32_t(out.nodes.size());
+		for (linear_bvh_node node : second.nodes) {
+			if (node.count == 0)
+				node.offset += base;
+			out.nodes.push_back(node);
+		}
+		out.costs.insert(out.costs.end(), second.costs.begin(), second.costs.end());
+	}
+
+	bool find_sah_split(const std::vector<aabb>& boxes, uint32_t begin, uint32_t end, const aabb& box, const aabb& centroid_box, int& split_axis, uint32_t& mid) {
+		// Same binned SAH as bvh_node::build_sah, returns false to make a leaf
+		// When all centroids coincide but there are too many primitives for one leaf, the range is split in half
+		uint32_t count = end - begin;
+		if (count <= 1)
+			return false;
+
+		int best_axis = -1;
+		int best_split = 0;
+		double best_cost = infinity;
+		double parent_area = box.surface_area();
+		for (int axis = 0; axis < 3; axis++) {
+			const interval& extent = centroid_box.axis_interval(axis);
+			if (extent.size() <= 0)
+				continue;
+
+			int counts[sah_bins] = {};
+			aabb bounds[sah_bins];
+			for (int b = 0; b < sah_bins; b++)
+				bounds[b] = aabb::empty;
+			for (uint32_t p = begin; p < end; p++) {
+				int b = bin_index(centroids[indices[p]][axis], extent);
+				counts[b]++;
+				bounds[b] = aabb(bounds[b], boxes[indices[p]]);
+			}
+
+			double right_areas[sah_bins];
+			int right_counts[sah_bins];
+			aabb right_box = aabb::empty;
+			int right_count = 0;
+			for (int b = sah_bins - 1; b > 0; b--) {
+				right_box = aabb(right_box, bounds[b]);
+				right_count += counts[b];
+				right_areas[b] = right_box.surface_area();
+				right_counts[b] = right_count;
+			}
+
+			aabb left_box = aabb::empty;
+			int left_count = 0;
+			for (int split = 1; split < sah_bins; split++) {
+				left_box = aabb(left_box, bounds[split - 1]);
+				left_count += counts[split - 1];
+				if (left_count == 0 || right_counts[split] == 0)
+					continue;
+				double split_cost = node_traversal_cost + (left_box.surface_area() * left_count + right_areas[split] * right_counts[split]) / parent_area;
+				if (split_cost < best_cost) {
+					best_cost = split_cost;
+					best_axis = axis;
+					best_split = split;
+				}
+			}
+		}
+
+		if (best_axis < 0) {
+			if (count <= max_leaf_primitives)
+				return false;
+			split_axis = box.longest_axis();
+			mid = begin + count / 2;
+			return true;
+		}
+		if (double(count) <= best_cost && count <= max_leaf_primitives)
+			return false;
+
+		const interval& extent = centroid_box.axis_interval(best_axis);
+		auto middle = std::partition(indices.begin() + begin, indices.begin() + end, [&](uint32_t index) {
+			return bin_index(centroids[index][best_axis], extent) < best_split;
+		});
+		split_axis = best_axis;
+		mid = uint32_t(middle - indices.begin());
+		return true;
+	}
+
+	bool find_spatial_split(const std::vector<reference>& references, const aabb& box, double root_area, size_t& spare_references, int& split_axis, std::vector<reference>& first, std::vector<reference>& second) {
+		// Binned SAH over the reference centroids like find_sah_split, then, where that split's children overlap, binned splits of space itself
+		// A spatial split clips the references straddling its plane into both children, as long as spare_references lasts
+		// Only the boxes are known, so a reference is clipped to its box's part on each side rather than to the primitive's
+		size_t count = references.size();
+		if (count <= 1)
+			return false;
+
+		aabb centroid_box = aabb::empty;
+		for (const reference& ref : references) {
+			point3 center = centroid(ref.box);
+			centroid_box = aabb(centroid_box, aabb(center, center));
+		}
+		double parent_area = box.surface_area();
+
+		bin_split object;
+		for (int axis = 0; axis < 3; axis++) {
+			const interval& extent = centroid_box.axis_interval(axis);
+			if (extent.size() <= 0)
+				continue;
+			int counts[sah_bins] = {};
+			aabb bounds[sah_bins];
+			for (const reference& ref : references) {
+				int b = bin_index(centroid(ref.box)[axis], extent);
+				counts[b]++;
+				bounds[b] = aabb(bounds[b], ref.box);
+			}
+			sweep_bins(counts, counts, bounds, parent_area, axis, object);
+		}
+
+		bin_split spatial;
+		if (spare_references > 0 && (object.axis < 0 || overlap(object.first_box, object.second_box).surface_area() > spatial_split_overlap * root_area)) {
+			for (int axis = 0; axis < 3; axis++) {
+				const interval& extent = box.axis_interval(axis);
+				if (extent.size() <= 0)
+					continue;
+				// A reference enters the first bin it touches and exits the last, and adds its clipped box to every bin in between
+				int entries[sah_bins] = {};
+				int exits[sah_bins] = {};
+				aabb bounds[sah_bins];
+				for (const reference& ref : references) {
+					const interval& span = ref.box.axis_interval(axis);
+					int first_bin = bin_index(span.min, extent);
+					int last_bin = bin_index(span.max, extent);
+					entries[first_bin]++;
+					exits[last_bin]++;
+					for (int b = first_bin; b <= last_bin; b++)
+						bounds[b] = aabb(bounds[b], clip(ref, axis, bin_plane(extent, b), bin_plane(extent, b + 1)));
+				}
+				sweep_bins(entries, exits, bounds, parent_area, axis, spatial);
+			}
+		}
+
+		double best_cost = std::min(object.cost, spatial.cost);
+		if (best_cost < infinity && double(count) <= best_cost && count <= max_leaf_primitives)
+			return false;
+
+		if (spatial.cost < object.cost) {
+			double plane = bin_plane(box.axis_interval(spatial.axis), spatial.split);
+			double first_area = spatial.first_box.surface_area();
+			double second_area = spatial.second_box.surface_area();
+			size_t clipped = 0;
+			for (const reference& ref : references) {
+				const interval& span = ref.box.axis_interval(spatial.axis);
+				if (span.max <= plane) {
+					first.push_back(ref);
+					continue;
+				}
+				if (span.min >= plane) {
+					second.push_back(ref);
+					continue;
+				}
+				// Keeps the whole reference on one side when growing that side's box costs less than another reference (reference unsplitting)
+				double both = first_area * spatial.first_count + second_area * spatial.second_count;
+				double only_first = aabb(spatial.first_box, ref.box).surface_area() * spatial.first_count + second_area * (spatial.second_count - 1);
+				double only_second = first_area * (spatial.first_count - 1) + aabb(spatial.second_box, ref.box).surface_area() * spatial.second_count;
+				if (clipped < spare_references && both < only_first && both < only_second) {
+					first.push_back({ clip(ref, spatial.axis, -infinity, plane), ref.index });
+					second.push_back({ clip(ref, spatial.axis, plane, infinity), ref.index });
+					clipped++;
+				}
+				else if (only_first <= only_second) {
+					first.push_back(ref);
+				}
+				else {
+					second.push_back(ref);
+				}
+			}
+			if (!first.empty() && !second.empty()) {
+				spare_references -= clipped;
+				split_axis = spatial.axis;
+				return true;
+			}
+			first.clear();
+			second.clear();
+		}
+
+		if (object.axis < 0) {
+			// All centroids coincide, halve the references if there are too many for one leaf
+			if (count <= max_leaf_primitives)
+				return false;
+			split_axis = box.longest_axis();
+			first.assign(references.begin(), references.begin() + count / 2);
+			second.assign(references.begin() + count / 2, references.end());
+			return true;
+		}
+		const interval& extent = centroid_box.axis_interval(object.axis);
+		for (const reference& ref : references) {
+			if (bin_index(centroid(ref.box)[object.axis], extent) < object.split)
+				first.push_back(ref);
+			else
+				second.push_back(ref);
+		}
+		split_axis = object.axis;
+		return true;
+	}
+
+	struct bin_split {
+		int axis = -1;
+		int split = 0; // The first bin of the second child
+		double cost = infinity;
+		aabb first_box, second_box;
+		int first_count = 0, second_count = 0;
+	};
+
+	static void sweep_bins(const int entries[sah_bins], const int exits[sah_bins], const aabb bounds[sah_bins], double parent_area, int axis, bin_split& best) {
+		// SAH cost of every plane between the bins of one axis, the first child holds what entered before the plane and the second what exits after it
+		aabb right_boxes[sah_bins];
+		int right_counts[sah_bins];
+		aabb right_box = aabb::empty;
+		int right_count = 0;
+		for (int b = sah_bins - 1; b > 0; b--) {
+			right_box = aabb(right_box, bounds[b]);
+			right_count += exits[b];
+			right_boxes[b] = right_box;
+			right_counts[b] = right_count;
+		}
+
+		aabb left_box = aabb::empty;
+		int left_count = 0;
+		for (int split = 1; split < sah_bins; split++) {
+			left_box = aabb(left_box, bounds[split - 1]);
+			left_count += entries[split - 1];
+			if (left_count == 0 || right_counts[split] == 0)
+				continue;
+			double split_cost = node_traversal_cost + (left_box.surface_area() * left_count + right_boxes[split].surface_area() * right_counts[split]) / parent_area;
+			if (split_cost < best.cost) {
+				best.axis = axis;
+				best.split = split;
+				best.cost = split_cost;
+				best.first_box = left_box;
+				best.second_box = right_boxes[split];
+				best.first_count = left_count;
+				best.second_count = right_counts[split];
+			}
+		}
+	}
+
+	static point3 centroid(const aabb& box) {
+		return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+	}
+
+	static double bin_plane(const interval& extent, int b) {
+		// The lower plane of bin b, the last bin ends exactly at the extent
+		return b >= sah_bins ? extent.max : extent.min + extent.size() * b / sah_bins;
+	}
+
+	aabb clip(const reference& ref, int axis, double min, double max) const {
+		// Part of a reference between two planes along axis, padded like the primitive boxes so it never turns flat
+		interval intervals[3] = { ref.box.x, ref.box.y, ref.box.z };
+		intervals[axis] = interval(std::max(intervals[axis].min, min), std::min(intervals[axis].max, max));
+		if (intervals[axis].min > intervals[axis].max)
+			return aabb::empty;
+		aabb clipped(intervals[0], intervals[1], intervals[2]);
+		if (clip_primitive)
+			clipped = overlap(clipped, clip_primitive(ref.index, axis, min, max));
+		if (clipped.x.min > clipped.x.max)
+			return aabb::empty;
+		clipped.pad_to_minimums();
+		return clipped;
+	}
+
+	static aabb overlap(const aabb& a, const aabb& b) {
+		interval x(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max));
+		interval y(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max));
+		interval z(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max));
+		if (x.min > x.max || y.min > y.max || z.min > z.max)
+			return aabb::empty;
+		return aabb(x, y, z);
+	}
+
+	static int bin_index(double centroid, const interval& extent) {
+		int b = int(sah_bins * (centroid - extent.min) / extent.size());
+		return std::clamp(b, 0, sah_bins - 1);
+	}
+
+	static void set_box(linear_bvh_node& node, const aabb& box) {
+		for (int axis = 0; axis < 3; axis++) {
+			const interval& extent = box.axis_interval(axis);
+			node.box_min[axis] = round_down(extent.min);
+			node.box_max[axis] = round_up(extent.max);
+		}
+	}
+
+	static linear_bvh_node at_time(const linear_bvh_node& node, const linear_bvh_motion& delta, float time) {
+		linear_bvh_node moved = node;
+		for (int axis = 0; axis < 3; axis++) {
+			moved.box_min[axis] += time * delta.delta_min[axis];
+			moved.box_max[axis] += time * delta.delta_max[axis];
+		}
+		return moved;
+	}
+
+	double refit_motion(uint32_t node_index, const std::vector<aabb>& start_boxes, const std::vector<aabb>& end_boxes, const std::vector<double>& primitive_costs, aabb& start, aabb& end) {
+		// Sets the subtree's boxes at times 0 and 1 bottom up, and returns its traversal cost
+		linear_bvh_node& node = node_storage[node_index];
+		double node_cost;
+		if (node.count > 0) {
+			start = end = aabb::empty;
+			node_cost = primitive_costs.empty() ? double(node.count) : 0.0;
+			for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+				start = aabb(start, start_boxes[indices[p]]);
+				end = aabb(end, end_boxes[indices[p]]);
+				if (!primitive_costs.empty())
+					node_cost += primitive_costs[indices[p]];
+			}
+		}
+		else {
+			aabb first_start, first_end, second_start, second_end;
+			double first_cost = refit_motion(node_index + 1, start_boxes, end_boxes, primitive_costs, first_start, first_end);
+			double second_cost = refit_motion(node.offset, start_boxes, end_boxes, primitive_costs, second_start, second_end);
+			start = aabb(first_start, second_start);
+			end = aabb(first_end, second_end);
+			double area = mean_surface_area(start, end);
+			double first_weight = area > 0 ? mean_surface_area(first_start, first_end) / area : 1.0;
+			double second_weight = area > 0 ? mean_surface_area(second_start, second_end) / area : 1.0;
+			node_cost = first_weight * first_cost + second_weight * second_cost;
+		}
+
+		// The float interpolation in at_time rounds a little, the start box is widened by a few float epsilons of the coordinates to make up for it
+		for (int axis = 0; axis < 3; axis++) {
+			const interval& from = start.axis_interval(axis);
+			const interval& to = end.axis_interval(axis);
+			double min_slack = 4 * std::numeric_limits<float>::epsilon() * (std::fabs(from.min) + std::fabs(to.min));
+			double max_slack = 4 * std::numeric_limits<float>::epsilon() * (std::fabs(from.max) + std::fabs(to.max));
+			node.box_min[axis] = round_down(from.min - min_slack);
+			node.box_max[axis] = round_up(from.max + max_slack);
+			motion[node_index].delta_min[axis] = float(to.min - from.min);
+			motion[node_index].delta_max[axis] = float(to.max - from.max);
+		}
+		return node_traversal_cost + node_cost;
+	}
+
+	static aabb lerp(const aabb& start, const aabb& end, double time) {
+		return aabb(interval((1 - time) * start.x.min + time * end.x.min, (1 - time) * start.x.max + time * end.x.max),
+			interval((1 - time) * start.y.min + time * end.y.min, (1 - time) * start.y.max + time * end.y.max),
+			interval((1 - time) * start.z.min + time * end.z.min, (1 - time) * start.z.max + time * end.z.max));
+	}
+
+	static double mean_surface_area(const aabb& start, const aabb& end) {
+		// Average over the shutter of the interpolated box's area, which is quadratic in time so Simpson's rule is exact
+		return (start.surface_area() + 4 * lerp(start, end, 0.5).surface_area() + end.surface_area()) / 6;
+	}
+
+	static float round_down(double value) {
+		float rounded = float(value);
+		return double(rounded) > value ? std::nextafter(rounded, -std::numeric_limits<float>::infinity()) : rounded;
+	}
+
+	static float round_up(double value) {
+		float rounded = float(value);
+		return double(rounded) < value ? std::nextafter(rounded, std::numeric_limits<float>::infinity()) : rounded;
+	}
+};
+
+#endif
@@ -15,6 +15,7 @@ public:
 	constant_medium(shared_ptr<hittable> boundary, double density, const colour& albedo) : boundary(boundary), neg_inv_density(-1 / density), phase_function(make_shared<isotropic>(albedo)) {}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_COUNT(primitive_tests[primitive_constant_medium]);
 		hit_record rec1, rec2;
 
 		if (!boundary->hit(r, interval::universe, rec1))
@@ -0,0 +1,171 @@
+#ifndef CUBOID_H
+#define CUBOID_H
+
+#include "hittable.hpp"
+
+// Axis aligned box, intersected with one slab test instead of six quads under a BVH
+// Faces have the same normals and texture coordinates as the six quads box() used to build
+class cuboid : public hittable {
+public:
+	cuboid(const point3& a, const point3& b, shared_ptr<material> mat) : mat(mat) {
+		box_min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
+		box_max = point3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z()));
+		extent = box_max - box_min;
+		bbox = aabb(box_min, box_max);
+		bbox.pad_to_minimums();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		double t;
+		int axis;
+		bool max_side;
+		if (!intersect(r, ray_t, t, axis, max_side))
+			return false;
+
+		rec.t = t;
+		rec.p = r.at(t);
+		vec3 outward_normal(0, 0, 0);
+		outward_normal[axis] = max_side ? 1 : -1;
+		set_uv(rec.p, axis, max_side, rec);
+		rec.mat_ptr = mat.get();
+		rec.set_face_normal(r, outward_normal);
+		return true;
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override {
+		double t;
+		int axis;
+		bool max_side;
+		return intersect(r, ray_t, t, axis, max_side);
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	double pdf_value(const point3& origin, const vec3& direction) const override {
+		// random picks points evenly over the faces seen from origin, and each direction towards the box meets exactly one of them first
+		double t;
+		int axis;
+		bool max_side;
+		if (!intersect(ray(origin, direction), interval(0, infinity), t, axis, max_side))
+			return 0;
+		double distance_squared = t * t * direction.length_squared();
+		double cosine = std::fabs(direction[axis] / direction.length());
+		double area = visible_area(origin);
+		if (cosine <= 0 || area <= 0)
+			return 0;
+		return distance_squared / (cosine * area);
+	}
+
+	vec3 random(const point3& origin) const override {
+		// A face seen from origin picked by its area (the last one seen if rounding runs past them all), then a point evenly on it
+		double target = random_double() * visible_area(origin);
+		int face_axis = -1;
+		bool face_max_side = false;
+		for (int axis = 0; axis < 3 && target >= 0; axis++) {
+			for (bool max_side : { false, true }) {
+				if (target < 0 || !visible(origin, axis, max_side))
+					continue;
+				face_axis = axis;
+				face_max_side = max_side;
+				target -= face_area(axis);
+			}
+		}
+		if (face_axis < 0)
+			return vec3(1, 0, 0);
+		point3 p = box_min;
+		p[face_axis] = face_max_side ? box_max[face_axis] : box_min[face_axis];
+		p[(face_axis + 1) % 3] += random_double() * extent[(face_axis + 1) % 3];
+		p[(face_axis + 2) % 3] += random_double() * extent[(face_axis + 2) % 3];
+		return p - origin;
+	}
+private:
+	point3 box_min;
+	point3 box_max;
+	vec3 extent;
+	aabb bbox;
+	shared_ptr<material> mat;
+
+	bool intersect(const ray& r, const interval& ray_t, double& t, int& axis, bool& max_side) const {
+		// Slab test keeping the axes the ray enters and leaves through, t is the entry if it is in ray_t, otherwise the exit (rays starting inside)
+		RT_COUNT(primitive_tests[primitive_box]);
+		double t_enter = -infinity, t_exit = infinity;
+		int enter_axis = 0, exit_axis = 0;
+		for (int a = 0; a < 3; a++) {
+			double direction = r.direction()[a];
+			if (direction == 0) {
+				// Parallel to the slab, which it is either always or never inside
+				if (r.origin()[a] < box_min[a] || r.origin()[a] > box_max[a])
+					return false;
+				continue;
+			}
+			double inverse = 1.0 / direction;
+			double t_near = ((direction > 0 ? box_min[a] : box_max[a]) - r.origin()[a]) * inverse;
+			double t_far = ((direction > 0 ? box_max[a] : box_min[a]) - r.origin()[a]) * inverse;
+			if (t_near > t_enter) {
+				t_enter = t_near;
+				enter_axis = a;
+			}
+			if (t_far < t_exit) {
+				t_exit = t_far;
+				exit_axis = a;
+			}
+		}
+		if (t_enter > t_exit)
+			return false;
+
+		// Entering through the min side of an axis means travelling towards +axis, leaving through the max side likewise
+		if (ray_t.contains(t_enter)) {
+			t = t_enter;
+			axis = enter_axis;
+			max_side = r.direction()[axis] < 0;
+			return true;
+		}
+		if (ray_t.contains(t_exit)) {
+			t = t_exit;
+			axis = exit_axis;
+			max_side = r.direction()[axis] > 0;
+			return true;
+		}
+		return false;
+	}
+
+	void set_uv(const point3& p, int axis, bool max_side, hit_record& rec) const {
+		// Same orientation per face as the quads: front/back and left/right run along x or z with v up, top/bottom along x and z
+		auto along = [&](int a) { return extent[a] > 0 ? (p[a] - box_min[a]) / extent[a] : 0.0; };
+		switch (axis) {
+		case 0: // Right (+x) and left (-x)
+			rec.u = max_side ? 1 - along(2) : along(2);
+			rec.v = along(1);
+			break;
+		case 1: // Top (+y) and bottom (-y)
+			rec.u = along(0);
+			rec.v = max_side ? 1 - along(2) : along(2);
+			break;
+		default: // Front (+z) and back (-z)
+			rec.u = max_side ? along(0) : 1 - along(0);
+			rec.v = along(1);
+			break;
+		}
+	}
+
+	bool visible(const point3& origin, int axis, bool max_side) const {
+		// Every face is seen from inside, from outside only those facing origin
+		bool inside = origin.x() >= box_min.x() && origin.x() <= box_max.x() && origin.y() >= box_min.y() && origin.y() <= box_max.y() && origin.z() >= box_min.z() && origin.z() <= box_max.z();
+		return inside || (max_side ? origin[axis] > box_max[axis] : origin[axis] < box_min[axis]);
+	}
+
+	double face_area(int axis) const {
+		return extent[(axis + 1) % 3] * extent[(axis + 2) % 3];
+	}
+
+	double visible_area(const point3& origin) const {
+		double area = 0;
+		for (int axis = 0; axis < 3; axis++)
+			for (bool max_side : { false, true })
+				if (visible(origin, axis, max_side))
+					area += face_area(axis);
+		return area;
+	}
+};
+
+#endif
@@ -31,8 +31,21 @@ public:
 
 	virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+	virtual bool occluded(const ray& r, interval ray_t) const {
+		// Any hit query: whether anything is hit within ray_t, without finding the nearest hit or filling a hit record
+		// Falls back on hit, for objects that can't stop any earlier (e.g. volumes)
+		hit_record rec;
+		return hit(r, ray_t, rec);
+	}
+
 	virtual aabb bounding_box() const = 0;
 
+	virtual aabb bounding_box_at(double time) const {
+		// Box at one ray time in [0, 1], overridden by moving objects so hierarchies can bound them per time instead of over their whole motion
+		// Hierarchies interpolate linearly between the boxes at 0 and 1, so the object must stay inside that interpolation at every time in between
+		return bounding_box();
+	}
+
 	virtual double pdf_value(const point3& origin, const vec3& direction) const {
 		return 0.0;
 	}
@@ -61,7 +74,13 @@ public:
 		return true;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+	}
+
 	aabb bounding_box() const override { return bbox; }
+
+	aabb bounding_box_at(double time) const override { return object->bounding_box_at(time).translate(offset); }
 private:
 	shared_ptr<hittable> object;
 	vec3 offset;
@@ -70,7 +89,7 @@ private:
 
 class rotate_y : public hittable {
 public:
-	rotate_y(shared_ptr<hittable> object, double angle) : object(object) {
+	rotate_y(shared_ptr<hittable> object, double angle) : object(object), angle(angle) {
 		double radians = degrees_to_radians(angle);
 		sin_theta = std::sin(radians);
 		cos_theta = std::cos(radians);
@@ -78,14 +97,8 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-		// Transform the ray from world space to object space
-		vec3 origin = vec3((cos_theta * r.origin().x()) - (sin_theta * r.origin().z()), r.origin().y(), (sin_theta * r.origin().x()) + (cos_theta * r.origin().z()));
-		vec3 direction = vec3((cos_theta * r.direction().x()) - (sin_theta * r.direction().z()), r.direction().y(), (sin_theta * r.direction().x()) + (cos_theta * r.direction().z()));
-
-		ray rotated_r(origin, direction, r.time());
-
 		// Determine whether an intersection exists in object space (and if so, where)
-		if (!object->hit(rotated_r, ray_t, rec))
+		if (!object->hit(to_object(r), ray_t, rec))
 			return false;
 
 		// Transform the intersection point from object space to world space
@@ -97,12 +110,29 @@ public:
 		return true;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		return object->occluded(to_object(r), ray_t);
+	}
+
 	aabb bounding_box() const override { return bbox; }
+
+	aabb bounding_box_at(double time) const override {
+		// The rotated corners of an interpolated box stay inside the interpolation of the rotated boxes, so the rotation keeps the bounds valid
+		return object->bounding_box_at(time).rotate_y(angle);
+	}
 private:
 	shared_ptr<hittable> object;
+	double angle;
 	double sin_theta;
 	double cos_theta;
 	aabb bbox;
+
+	ray to_object(const ray& r) const {
+		// Transform the ray from world space to object space
+		vec3 origin = vec3((cos_theta * r.origin().x()) - (sin_theta * r.origin().z()), r.origin().y(), (sin_theta * r.origin().x()) + (cos_theta * r.origin().z()));
+		vec3 direction = vec3((cos_theta * r.direction().x()) - (sin_theta * r.direction().z()), r.direction().y(), (sin_theta * r.direction().x()) + (cos_theta * r.direction().z()));
+		return ray(origin, direction, r.time());
+	}
 };
 
 #endif
\ No newline at end of file
@@ -34,10 +34,24 @@ public:
 		return hit_anything;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		for (const shared_ptr<hittable>& object : objects)
+			if (object->occluded(r, ray_t))
+				return true;
+		return false;
+	}
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
 
+	aabb bounding_box_at(double time) const override {
+		aabb box = aabb::empty;
+		for (const shared_ptr<hittable>& object : objects)
+			box = aabb(box, object->bounding_box_at(time));
+		return box;
+	}
+
 	double pdf_value(const point3& origin, const vec3& direction) const override {
 		double weight = 1.0 / objects.size();
 		double sum = 0.0;
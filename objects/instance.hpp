@@ -0,0 +1,147 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.hpp"
+
+// Affine transform: a 3x3 matrix followed by a translation
+// The inverse matrix is kept alongside, since instances need both directions and normals need the inverse transpose
+class transform {
+public:
+	transform() : matrix{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } }, inverse_matrix{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } }, offset(0, 0, 0) {}
+
+	static transform translation(const vec3& offset) {
+		transform t;
+		t.offset = offset;
+		return t;
+	}
+
+	static transform rotation_y(double angle) {
+		// Same rotation as the rotate_y hittable, angle in degrees
+		double radians = degrees_to_radians(angle);
+		double sin_theta = std::sin(radians);
+		double cos_theta = std::cos(radians);
+		transform t;
+		t.matrix[0][0] = cos_theta; t.matrix[0][2] = sin_theta;
+		t.matrix[2][0] = -sin_theta; t.matrix[2][2] = cos_theta;
+		t.inverse_matrix[0][0] = cos_theta; t.inverse_matrix[0][2] = -sin_theta;
+		t.inverse_matrix[2][0] = sin_theta; t.inverse_matrix[2][2] = cos_theta;
+		return t;
+	}
+
+	static transform scaling(const vec3& scale) {
+		transform t;
+		for (int axis = 0; axis < 3; axis++) {
+			t.matrix[axis][axis] = scale[axis];
+			t.inverse_matrix[axis][axis] = 1.0 / scale[axis];
+		}
+		return t;
+	}
+
+	transform operator*(const transform& other) const {
+		// The combined transform applies other first, then this one
+		transform t;
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++) {
+				t.matrix[row][column] = 0;
+				t.inverse_matrix[row][column] = 0;
+				for (int k = 0; k < 3; k++) {
+					t.matrix[row][column] += matrix[row][k] * other.matrix[k][column];
+					t.inverse_matrix[row][column] += other.inverse_matrix[row][k] * inverse_matrix[k][column];
+				}
+			}
+		}
+		t.offset = apply_vector(other.offset) + offset;
+		return t;
+	}
+
+	transform inverse() const {
+		transform t;
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++) {
+				t.matrix[row][column] = inverse_matrix[row][column];
+				t.inverse_matrix[row][column] = matrix[row][column];
+			}
+		}
+		t.offset = -t.apply_vector(offset);
+		return t;
+	}
+
+	point3 apply_point(const point3& p) const {
+		return apply_vector(p) + offset;
+	}
+
+	vec3 apply_vector(const vec3& v) const {
+		return vec3(
+			matrix[0][0] * v.x() + matrix[0][1] * v.y() + matrix[0][2] * v.z(),
+			matrix[1][0] * v.x() + matrix[1][1] * v.y() + matrix[1][2] * v.z(),
+			matrix[2][0] * v.x() + matrix[2][1] * v.y() + matrix[2][2] * v.z()
+		);
+	}
+
+	vec3 apply_normal(const vec3& n) const {
+		// Normals go through the inverse transpose, so they stay perpendicular to the surface under non-uniform scaling
+		return unit_vector(vec3(
+			inverse_matrix[0][0] * n.x() + inverse_matrix[1][0] * n.y() + inverse_matrix[2][0] * n.z(),
+			inverse_matrix[0][1] * n.x() + inverse_matrix[1][1] * n.y() + inverse_matrix[2][1] * n.z(),
+			inverse_matrix[0][2] * n.x() + inverse_matrix[1][2] * n.y() + inverse_matrix[2][2] * n.z()
+		));
+	}
+
+	aabb apply_box(const aabb& box) const {
+		// Box around the eight transformed corners
+		point3 min(infinity, infinity, infinity);
+		point3 max(-infinity, -infinity, -infinity);
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 2; j++) {
+				for (int k = 0; k < 2; k++) {
+					point3 corner = apply_point(point3(i ? box.x.max : box.x.min, j ? box.y.max : box.y.min, k ? box.z.max : box.z.min));
+					for (int c = 0; c < 3; c++) {
+						min[c] = std::fmin(min[c], corner[c]);
+						max[c] = std::fmax(max[c], corner[c]);
+					}
+				}
+			}
+		}
+		return aabb(min, max);
+	}
+private:
+	double matrix[3][3];
+	double inverse_matrix[3][3];
+	vec3 offset;
+};
+
+// A placement of shared geometry (usually a BVH built once per unique mesh) in the world
+// Any number of instances can reference the same object, so memory grows with the unique geometry and the top level BVH only holds the instances
+class instance : public hittable {
+public:
+	instance(shared_ptr<hittable> object, const transform& object_to_world) : object(object), object_to_world(object_to_world), world_to_object(object_to_world.inverse()) {
+		bbox = object_to_world.apply_box(object->bounding_box());
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		// The direction isn't normalised in object space, so t means the same distance along the ray in both spaces
+		ray object_r(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()), r.time());
+
+		if (!object->hit(object_r, ray_t, rec))
+			return false;
+
+		rec.p = object_to_world.apply_point(rec.p);
+		rec.normal = object_to_world.apply_normal(rec.normal);
+		return true;
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override {
+		return object->occluded(ray(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()), r.time()), ray_t);
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	aabb bounding_box_at(double time) const override { return object_to_world.apply_box(object->bounding_box_at(time)); }
+private:
+	shared_ptr<hittable> object;
+	transform object_to_world;
+	transform world_to_object;
+	aabb bbox;
+};
+
+#endif
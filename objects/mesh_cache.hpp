@@ -0,0 +1,197 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mapped_file.hpp"
+#include "triangle_mesh.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Everything a built mesh depends on, a cache file is only used if all of it matches
+struct mesh_cache_key {
+	uint64_t source_hash = 0;
+	uint64_t source_size = 0;
+	float scale = 1;
+	uint32_t builder = 0;
+	uint32_t node_width = 0; // 2, 4 or 8, see bvh_hierarchy::node_width
+	float spatial_split_budget = 0; // bvh_tree::spatial_split_budget, 0 unless the builder is bvh_sbvh
+
+	bool operator==(const mesh_cache_key& other) const {
+		return source_hash == other.source_hash && source_size == other.source_size && scale == other.scale && builder == other.builder && node_width == other.node_width && spatial_split_budget == other.spatial_split_budget;
+	}
+};
+
+// Binary file next to a model holding its triangle_mesh (vertices, leaf ordered indices, area sums) and the built BVH nodes
+// Loading maps the file and points the mesh straight at it, so there is nothing to parse or build and pages are only read as rays touch them
+class mesh_cache {
+public:
+	static inline bool enabled = true; // --no-mesh-cache turns both loading and saving off
+
+	static std::string path_for(const char model_path[]) {
+		return std::string(model_path) + ".bvhcache";
+	}
+
+	static mesh_cache_key key(const mapped_file& source, float scale) {
+		// The BVH settings are those that models built from now on would use
+		mesh_cache_key key;
+		key.source_hash = hash(source.data(), source.size());
+		key.source_size = source.size();
+		key.scale = scale;
+		key.builder = uint32_t(bvh_node::builder);
+		key.node_width = (bvh_hierarchy::branching == 4 || bvh_hierarchy::branching == 8) ? bvh_hierarchy::branching : 2;
+		key.spatial_split_budget = bvh_node::builder == bvh_sbvh ? float(bvh_tree::spatial_split_budget) : 0.0f;
+		return key;
+	}
+
+	static shared_ptr<triangle_mesh> load(const std::string& path, const mesh_cache_key& key, shared_ptr<material> mat) {
+		// Returns nullptr if there is no cache file, or it doesn't match key or this build's layout
+		shared_ptr<mapped_file> file = make_shared<mapped_file>(path.c_str());
+		if (!file->is_open() || file->size() < sizeof(header))
+			return nullptr;
+		header head;
+		std::memcpy(&head, file->data(), sizeof(header));
+		if (std::memcmp(head.magic, magic, sizeof(magic)) != 0 || head.version != version || !(head.key == key) || head.node_size != node_size(key.node_width))
+			return nullptr;
+		if (!section_fits(*file, head.positions_offset, head.vertex_count * 3 * sizeof(float)) ||
+			!section_fits(*file, head.indices_offset, head.triangle_count * 3 * sizeof(uint32_t)) ||
+			!section_fits(*file, head.area_offset, head.triangle_count * sizeof(float)) ||
+			!section_fits(*file, head.nodes_offset, head.node_bytes) || head.node_bytes % head.node_size != 0) {
+			std::clog << "Mesh cache '" << path << "' is truncated, rebuilding it\n";
+			return nullptr;
+		}
+
+		const char* data = file->data();
+		std::span<const float> positions(reinterpret_cast<const float*>(data + head.positions_offset), head.vertex_count * 3);
+		std::span<const uint32_t> indices(reinterpret_cast<const uint32_t*>(data + head.indices_offset), head.triangle_count * 3);
+		std::span<const float> area_sums(reinterpret_cast<const float*>(data + head.area_offset), head.triangle_count);
+		std::span<const std::byte> nodes(reinterpret_cast<const std::byte*>(data + head.nodes_offset), head.node_bytes);
+		aabb box(interval(head.box_min[0], head.box_max[0]), interval(head.box_min[1], head.box_max[1]), interval(head.box_min[2], head.box_max[2]));
+		bvh_hierarchy hierarchy(key.node_width, nodes, box, head.cost);
+		return make_shared<triangle_mesh>(file, positions, indices, area_sums, head.total_area, std::move(hierarchy), mat);
+	}
+
+	static bool save(const std::string& path, const mesh_cache_key& key, const triangle_mesh& mesh) {
+		// Written next to the final path and renamed over it, so an interrupted save never leaves a half written cache behind
+		header head = {};
+		std::memcpy(head.magic, magic, sizeof(magic));
+		head.version = version;
+		head.key = key;
+		head.node_size = node_size(key.node_width);
+		if (mesh.bvh().node_width() != int(key.node_width) || mesh.is_compressed())
+			return false;
+
+		// Meshes reading their vertices in place from a strided or scaled layout are saved packed
+		std::vector<float> packed;
+		std::span<const float> positions = mesh.vertex_positions();
+		if (positions.size() != mesh.vertex_count() * 3) {
+			packed = mesh.packed_positions();
+			positions = packed;
+		}
+		std::span<const uint32_t> indices = mesh.triangle_indices();
+		std::span<const float> area_sums = mesh.area_sums();
+		std::span<const std::byte> nodes = mesh.bvh().node_data();
+		head.vertex_count = positions.size() / 3;
+		head.triangle_count = indices.size() / 3;
+		head.node_bytes = nodes.size();
+		head.positions_offset = align(sizeof(header));
+		head.indices_offset = align(head.positions_offset + positions.size_bytes());
+		head.area_offset = align(head.indices_offset + indices.size_bytes());
+		head.nodes_offset = align(head.area_offset + area_sums.size_bytes());
+		aabb box = mesh.bounding_box();
+		for (int axis = 0; axis < 3; axis++) {
+			head.box_min[axis] = box.axis_interval(axis).min;
+			head.box_max[axis] = box.axis_interval(axis).max;
+		}
+		head.cost = mesh.traversal_cost();
+		head.total_area = mesh.surface_area();
+
+		std::string temporary_path = path + ".tmp";
+		{
+			std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+			if (!out.is_open()) {
+				std::clog << "Couldn't write mesh cache '" << temporary_path << "'\n";
+				return false;
+			}
+			write_section(out, 0, &head, sizeof(header));
+			write_section(out, head.positions_offset, positions.data(), positions.size_bytes());
+			write_section(out, head.indices_offset, indices.data(), indices.size_bytes());
+			write_section(out, head.area_offset, area_sums.data(), area_sums.size_bytes());
+			write_section(out, head.nodes_offset, nodes.data(), nodes.size_bytes());
+			if (!out.good()) {
+				std::clog << "Couldn't write mesh cache '" << temporary_path << "'\n";
+				out.close();
+				std::error_code error;
+				std::filesystem::remove(temporary_path, error);
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary_path, path, error);
+		if (error) {
+			std::clog << "Couldn't replace mesh cache '" << path << "': " << error.message() << "\n";
+			std::filesystem::remove(temporary_path, error);
+			return false;
+		}
+		return true;
+	}
+
+	static uint64_t hash(const char* data, size_t size) {
+		// FNV-1a over 8 byte words, fast enough to hash a large model on every launch
+		uint64_t value = 14695981039346656037ull;
+		size_t index = 0;
+		for (; index + 8 <= size; index += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + index, 8);
+			value = (value ^ word) * 1099511628211ull;
+		}
+		for (; index < size; index++)
+			value = (value ^ uint8_t(data[index])) * 1099511628211ull;
+		return value;
+	}
+private:
+	static constexpr char magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', '\r', '\n' };
+	static constexpr uint32_t version = 2; // Bump whenever the layout of the file or of the nodes changes
+	static constexpr uint64_t section_alignment = 64; // Covers the 32 byte alignment of the wide nodes
+
+	struct header {
+		char magic[8];
+		uint32_t version;
+		uint32_t node_size; // Also catches node layouts that differ between builds
+		mesh_cache_key key;
+		uint64_t vertex_count, triangle_count, node_bytes;
+		uint64_t positions_offset, indices_offset, area_offset, nodes_offset;
+		double box_min[3], box_max[3];
+		double cost;
+		double total_area;
+	};
+
+	static uint32_t node_size(uint32_t node_width) {
+		if (node_width == 4)
+			return sizeof(wide_bvh_node<4>);
+		if (node_width == 8)
+			return sizeof(wide_bvh_node<8>);
+		return sizeof(linear_bvh_node);
+	}
+
+	static uint64_t align(uint64_t offset) {
+		return (offset + section_alignment - 1) / section_alignment * section_alignment;
+	}
+
+	static bool section_fits(const mapped_file& file, uint64_t offset, uint64_t size) {
+		return offset % section_alignment == 0 && offset <= file.size() && size <= file.size() - offset;
+	}
+
+	static void write_section(std::ofstream& out, uint64_t offset, const void* data, size_t size) {
+		// Pads with zeros up to the section's offset
+		static const char zeros[section_alignment] = {};
+		uint64_t position = uint64_t(out.tellp());
+		if (offset > position)
+			out.write(zeros, std::streamsize(offset - position));
+		out.write(static_cast<const char*>(data), std::streamsize(size));
+	}
+};
+
+#endif
@@ -1,162 +1,420 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <string>
+#include <string_view>
 #include "bvh.hpp"
-/*
-class box : public hittable {
+#include "cuboid.hpp"
+#include "mesh_cache.hpp"
+#include "obj_parser.hpp"
+#include "triangle_mesh.hpp"
+// Creates a box from the two points specified and material
+inline shared_ptr<hittable> box(const point3& a, const point3& b, shared_ptr<material> mat)
+{
+	// Returns the 3D box (six sides) that contains the two opposite vertices a & b, as one cuboid instead of six quads under a BVH
+	return make_shared<cuboid>(a, b, mat);
+}
+
+// Vertices and triangles of a binary PLY file, pointing into the mapped file wherever its layout allows
+struct ply_mesh {
+	shared_ptr<const void> owner; // Keeps the vertices alive: the mapped file, or the positions decoded from it
+	vertex_view vertices;
+	triangle_view triangles; // Into the mapped file or indices, only read while the mesh is built
+	std::vector<uint32_t> indices;
+	size_t skipped_triangles = 0; // Triangles that referenced a vertex the file doesn't have
+	bool vertices_in_place = false;
+	bool triangles_in_place = false;
+};
+
+// Binary PLY reader (binary_little_endian and binary_big_endian), ASCII PLY files aren't supported
+// Float x, y, z vertices in a little endian file are used where they are, through a strided view that skips the other properties
+// So are the faces when every one is a triangle with a uchar count and 32 bit indices, which is what scanners and most exporters write
+// Anything else (big endian, double or integer coordinates, polygons, other index types) is decoded into arrays, polygons split into fans like obj_parser
+class ply_reader {
 public:
-	box(const vec3& a, const vec3& b, shared_ptr<material> mat) : mat(mat) {
-		point3 min = point3(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
-		point3 max = point3(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
-
-		vec3 dx = vec3(max.x() - min.x(), 0, 0);
-		vec3 dy = vec3(0, max.y() - min.y(), 0);
-		vec3 dz = vec3(0, 0, max.z() - min.z());
-
-		
-		sides.add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
-		sides.add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
-		sides.add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
-		sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
-		sides.add(make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
-		sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
-		hierarchy = make_shared<bvh_node>(sides);
-
-		bbox = aabb(box_min, box_max);
-		bbox.pad_to_minimums();
+	static bool is_ply(const char* data, size_t size) {
+		return size >= 4 && std::memcmp(data, "ply", 3) == 0 && (data[3] == '\n' || data[3] == '\r');
 	}
 
-	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-		// IMPROVED: Faster method as using stack memory (instead of dynamic), less memory, more cache friendly
-		// Code obtained from https://github.com/define-private-public/PSRayTracing/blob/r1/src/Objects/Box.cpp
-		return hierarchy->hit(r, ray_t, rec);
-	}
-	aabb bounding_box() const override { return bbox; }
+	static bool read(const shared_ptr<const mapped_file>& file, float scale, ply_mesh& out) {
+		// Returns false, after saying why, if the file can't be read
+		const char* end = file->data() + file->size();
+		std::vector<element> elements;
+		bool little_endian = true;
+		const char* p = parse_header(file->data(), end, elements, little_endian);
+		if (p == nullptr)
+			return false;
+		bool swap = little_endian != (std::endian::native == std::endian::little);
+
+		bool found_vertices = false, found_faces = false;
+		for (const element& e : elements) {
+			if (e.name == "vertex" && !found_vertices) {
+				found_vertices = true;
+				p = read_vertices(e, p, end, swap, scale, file, out);
+			}
+			else if (e.name == "face" && !found_faces) {
+				found_faces = true;
+				p = read_faces(e, p, end, swap, out);
+			}
+			else {
+				for (size_t row = 0; row < e.count && p != nullptr; row++)
+					p = visit_row(e, p, end, swap, [](size_t, const char*, size_t) {});
+			}
+			if (p == nullptr) {
+				std::clog << "PLY file is truncated in its " << e.name << " element\n";
+				return false;
+			}
+		}
+		if (!found_vertices) {
+			std::clog << "PLY file has no vertex element\n";
+			return false;
+		}
 
+		// Decoded faces may come before the vertices, so like obj_parser their indices are only checked once every vertex is known
+		if (!out.triangles_in_place) {
+			size_t kept = 0;
+			for (size_t triangle = 0; triangle < out.indices.size(); triangle += 3) {
+				if (out.indices[triangle] >= out.vertices.count || out.indices[triangle + 1] >= out.vertices.count || out.indices[triangle + 2] >= out.vertices.count) {
+					out.skipped_triangles++;
+					continue;
+				}
+				std::copy_n(&out.indices[triangle], 3, &out.indices[kept]);
+				kept += 3;
+			}
+			out.indices.resize(kept);
+			out.triangles = { reinterpret_cast<const char*>(out.indices.data()), 3 * sizeof(uint32_t), 0, kept / 3 };
+		}
+		return true;
+	}
 private:
-	vec3 box_min;
-	vec3 box_max;
-	aabb bbox;
-	shared_ptr<material> mat;
-	hittable_list sides{};
-	shared_ptr<bvh_node> hierarchy;
-};
-*/
-// Creates a box from the two points specified and material
-inline shared_ptr<bvh_node> box(const point3& a, const point3& b, shared_ptr<material> mat)
-{
-	// Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+	enum value_type { ply_int8, ply_uint8, ply_int16, ply_uint16, ply_int32, ply_uint32, ply_float32, ply_float64, ply_invalid };
 
-	hittable_list sides;
+	struct property {
+		std::string name;
+		value_type type = ply_invalid; // Of the items for a list
+		value_type count_type = ply_invalid; // Only set for lists
+		size_t offset = 0; // From the start of the row, when the element has no lists
+	};
 
-	// Construct the two opposite vertices with the minimum and maximum coordinates.
-	point3 min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
-	point3 max = point3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z()));
+	struct element {
+		std::string name;
+		size_t count = 0;
+		std::vector<property> properties;
+		bool fixed_size = true; // No list properties, so every row is stride bytes
+		size_t stride = 0;
+	};
 
-	vec3 dx = vec3(max.x() - min.x(), 0, 0);
-	vec3 dy = vec3(0, max.y() - min.y(), 0);
-	vec3 dz = vec3(0, 0, max.z() - min.z());
+	static size_t type_size(value_type type) {
+		static constexpr size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+		return sizes[type];
+	}
 
-	sides.add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat)); // front
-	sides.add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
-	sides.add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
-	sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat)); // left
-	sides.add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top
-	sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat)); // bottom
+	static value_type parse_type(std::string_view name) {
+		static constexpr std::string_view names[][2] = { { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" }, { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" } };
+		for (int type = 0; type < ply_invalid; type++)
+			if (name == names[type][0] || name == names[type][1])
+				return value_type(type);
+		return ply_invalid;
+	}
 
-	return make_shared<bvh_node>(sides);
-}
+	static double read_value(const char* p, value_type type, bool swap) {
+		// Byte by byte, since values in a PLY file needn't be aligned
+		unsigned char bytes[8];
+		size_t size = type_size(type);
+		std::memcpy(bytes, p, size);
+		if (swap)
+			std::reverse(bytes, bytes + size);
+		switch (type) {
+		case ply_int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+		case ply_uint8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+		case ply_int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+		case ply_uint16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+		case ply_int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+		case ply_uint32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+		case ply_float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+		case ply_float64: { double v; std::memcpy(&v, bytes, 8); return v; }
+		default: return 0;
+		}
+	}
 
-#define MAX_VERTICES 131068
+	static const char* parse_header(const char* data, const char* end, std::vector<element>& elements, bool& little_endian) {
+		// Returns where the binary data starts, or nullptr if the header isn't one this reader understands
+		const char* p = data;
+		bool has_format = false;
+		while (p < end) {
+			const char* line_end = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+			if (line_end == nullptr)
+				break;
+			std::string_view line(p, size_t(line_end - p));
+			p = line_end + 1;
+			if (!line.empty() && line.back() == '\r')
+				line.remove_suffix(1);
 
-// Imports a model
-inline shared_ptr<bvh_node> model(const char filePath[], const float scale, shared_ptr<material> mat)
-{
-	hittable_list finalModel;
+			std::vector<std::string_view> words;
+			for (size_t start = 0; start < line.size();) {
+				size_t stop = std::min(line.find(' ', start), line.size());
+				if (stop > start)
+					words.push_back(line.substr(start, stop - start));
+				start = stop + 1;
+			}
+			if (words.empty() || words[0] == "ply" || words[0] == "comment" || words[0] == "obj_info")
+				continue;
+
+			if (words[0] == "end_header") {
+				if (!has_format) {
+					std::clog << "PLY header has no format line\n";
+					return nullptr;
+				}
+				return p;
+			}
+			if (words[0] == "format" && words.size() >= 2) {
+				if (words[1] != "binary_little_endian" && words[1] != "binary_big_endian") {
+					std::clog << "PLY format '" << words[1] << "' isn't supported, only binary_little_endian and binary_big_endian are\n";
+					return nullptr;
+				}
+				has_format = true;
+				little_endian = words[1] == "binary_little_endian";
+			}
+			else if (words[0] == "element" && words.size() >= 3) {
+				element e;
+				e.name = words[1];
+				if (std::from_chars(words[2].data(), words[2].data() + words[2].size(), e.count).ec != std::errc()) {
+					std::clog << "PLY element '" << e.name << "' has an invalid count\n";
+					return nullptr;
+				}
+				elements.push_back(e);
+			}
+			else if (words[0] == "property" && !elements.empty()) {
+				element& e = elements.back();
+				property prop;
+				bool is_list = words.size() >= 5 && words[1] == "list";
+				if (is_list) {
+					prop.count_type = parse_type(words[2]);
+					prop.type = parse_type(words[3]);
+					prop.name = words[4];
+				}
+				else if (words.size() >= 3) {
+					prop.type = parse_type(words[1]);
+					prop.name = words[2];
+				}
+				if (prop.type == ply_invalid || (is_list && (prop.count_type == ply_invalid || prop.count_type == ply_float32 || prop.count_type == ply_float64))) {
+					std::clog << "PLY property line '" << line << "' isn't valid\n";
+					return nullptr;
+				}
+				prop.offset = e.stride;
+				e.stride += type_size(prop.type);
+				e.fixed_size = e.fixed_size && !is_list;
+				e.properties.push_back(prop);
+			}
+		}
+		std::clog << "PLY header has no end_header line\n";
+		return nullptr;
+	}
+
+	template<typename visitor>
+	static const char* visit_row(const element& e, const char* p, const char* end, bool swap, const visitor& visit) {
+		// Calls visit(property, values, count) for each property of the row at p (count is 1 unless it is a list), returns the next row or nullptr if the file ends first
+		for (size_t index = 0; index < e.properties.size(); index++) {
+			const property& prop = e.properties[index];
+			size_t count = 1;
+			if (prop.count_type != ply_invalid) {
+				if (size_t(end - p) < type_size(prop.count_type))
+					return nullptr;
+				double value = read_value(p, prop.count_type, swap);
+				count = value > 0 ? size_t(value) : 0;
+				p += type_size(prop.count_type);
+			}
+			size_t bytes = count * type_size(prop.type);
+			if (size_t(end - p) < bytes)
+				return nullptr;
+			visit(index, p, count);
+			p += bytes;
+		}
+		return p;
+	}
 
-	std::ifstream file(filePath);
+	static size_t find_property(const element& e, std::string_view name) {
+		for (size_t index = 0; index < e.properties.size(); index++)
+			if (e.properties[index].name == name)
+				return index;
+		return e.properties.size();
+	}
 
-	if (file.is_open()) {
-		std::string buffer;
-		int vertexCount = 0;
+	static const char* read_vertices(const element& e, const char* p, const char* end, bool swap, float scale, const shared_ptr<const mapped_file>& file, ply_mesh& out) {
+		size_t axes[3] = { find_property(e, "x"), find_property(e, "y"), find_property(e, "z") };
+		for (size_t axis : axes) {
+			if (axis == e.properties.size() || e.properties[axis].count_type != ply_invalid) {
+				std::clog << "PLY vertices don't have x, y and z properties, so the model has no vertices\n";
+				for (size_t row = 0; row < e.count && p != nullptr; row++)
+					p = visit_row(e, p, end, swap, [](size_t, const char*, size_t) {});
+				return p;
+			}
+		}
+
+		// In place if x, y and z are consecutive floats in the host's byte order
+		const property& x = e.properties[axes[0]];
+		bool in_place = e.fixed_size && !swap && x.type == ply_float32 && e.properties[axes[1]].type == ply_float32 && e.properties[axes[2]].type == ply_float32 &&
+			e.properties[axes[1]].offset == x.offset + sizeof(float) && e.properties[axes[2]].offset == x.offset + 2 * sizeof(float);
+		if (in_place) {
+			if (e.stride > 0 && e.count > size_t(end - p) / e.stride)
+				return nullptr;
+			out.owner = file;
+			out.vertices = { p + x.offset, e.stride, e.count, scale };
+			out.vertices_in_place = true;
+			return p + e.count * e.stride;
+		}
 
-		std::clog << "Opened file '" << filePath << "'\n";
+		// Scaled in float like obj_parser, so both give the same vertices
+		shared_ptr<std::vector<float>> positions = make_shared<std::vector<float>>(e.count * 3);
+		for (size_t row = 0; row < e.count && p != nullptr; row++) {
+			p = visit_row(e, p, end, swap, [&](size_t index, const char* values, size_t) {
+				for (int axis = 0; axis < 3; axis++)
+					if (index == axes[axis])
+						(*positions)[3 * row + axis] = float(read_value(values, e.properties[index].type, swap)) * scale;
+			});
+		}
+		out.owner = positions;
+		out.vertices = { reinterpret_cast<const char*>(positions->data()), 3 * sizeof(float), e.count, 1.0f };
+		return p;
+	}
+
+	static const char* read_faces(const element& e, const char* p, const char* end, bool swap, ply_mesh& out) {
+		size_t list = find_property(e, "vertex_indices");
+		if (list == e.properties.size())
+			list = find_property(e, "vertex_index");
+		if (list == e.properties.size() || e.properties[list].count_type == ply_invalid) {
+			std::clog << "PLY faces don't have a vertex_indices list, so the model has no triangles\n";
+			for (size_t row = 0; row < e.count && p != nullptr; row++)
+				p = visit_row(e, p, end, swap, [](size_t, const char*, size_t) {});
+			return p;
+		}
 
-		// First round to count number of vertices
-		while (file.good()) {
-			file >> buffer;
-			if (!buffer.compare("v")) {
-				vertexCount++;
+		// In place if every row is just a uchar 3 and three 32 bit indices of vertices already read
+		// The check reads each face once, the indices are then read in place while the BVH is built
+		const property& prop = e.properties[list];
+		constexpr size_t row_size = 1 + 3 * sizeof(uint32_t);
+		if (!swap && e.properties.size() == 1 && (prop.count_type == ply_uint8 || prop.count_type == ply_int8) && (prop.type == ply_int32 || prop.type == ply_uint32) && e.count <= size_t(end - p) / row_size) {
+			bool in_place = true;
+			for (size_t row = 0; row < e.count && in_place; row++) {
+				const char* face = p + row * row_size;
+				uint32_t corners[3];
+				std::memcpy(corners, face + 1, sizeof(corners));
+				// Negative int32 indices become large uint32 ones, which fail the check as well
+				in_place = face[0] == 3 && corners[0] < out.vertices.count && corners[1] < out.vertices.count && corners[2] < out.vertices.count;
+			}
+			if (in_place) {
+				out.triangles = { p, row_size, 1, e.count };
+				out.triangles_in_place = true;
+				return p + e.count * row_size;
 			}
 		}
-		if (vertexCount <= MAX_VERTICES) {
-			file.clear();
-			file.seekg(0);
-
-			vec3* vertexArray = new vec3[vertexCount];
-			vec3 vec3Buffer = vec3();
-			int index = 0;
-			int v1 = 0;
-			int v2 = 0;
-			int v3 = 0;
-
-			// Second round to store data
-			while (file.good()) {
-				file >> buffer;
-				if (!buffer.compare("v")) {
-					file >> buffer;
-					vec3Buffer[0] = stof(buffer) * scale;
-					file >> buffer;
-					vec3Buffer[1] = stof(buffer) * scale;
-					file >> buffer;
-					vec3Buffer[2] = stof(buffer) * scale;
-					if (index < vertexCount) {
-						vertexArray[index] = vec3Buffer;
-					}
-					
-					index++;
+
+		// A fan from the first corner, anything that can't be a vertex index becomes UINT32_MAX and is dropped along with its triangle at the end of read
+		std::vector<uint32_t> corners;
+		for (size_t row = 0; row < e.count && p != nullptr; row++) {
+			p = visit_row(e, p, end, swap, [&](size_t index, const char* values, size_t count) {
+				if (index != list)
+					return;
+				corners.clear();
+				for (size_t corner = 0; corner < count; corner++) {
+					double value = read_value(values + corner * type_size(prop.type), prop.type, swap);
+					corners.push_back(value >= 0 && value < double(UINT32_MAX) ? uint32_t(value) : UINT32_MAX);
 				}
-				else if (!buffer.compare("f")) {
-					// Subtract 1 due to first vertex counted as 1
-					file >> buffer;
-					v1 = stoi(buffer) - 1;
-					file >> buffer;
-					v2 = stoi(buffer) - 1;
-					file >> buffer;
-					v3 = stoi(buffer) - 1;
-					if (v1 < vertexCount && v2 < vertexCount && v3 < vertexCount) {
-						finalModel.add(make_shared<triangle>(vertexArray[v1], vertexArray[v2] - vertexArray[v1], vertexArray[v3] - vertexArray[v1], mat));
-					}
-					else {
-						std::clog << "More vertices referenced in face than counted\n";
-					}
+				for (size_t corner = 2; corner < corners.size(); corner++) {
+					out.indices.push_back(corners[0]);
+					out.indices.push_back(corners[corner - 1]);
+					out.indices.push_back(corners[corner]);
 				}
-			}
-			delete[] vertexArray;
+			});
 		}
-		else {
-			std::clog << "More than max vertices loaded: " << vertexCount << "\n";
-		}
-		file.close();
+		return p;
 	}
-	else {
+};
+
+// Imports a model, a Wavefront OBJ file or a binary PLY file
+inline shared_ptr<hittable> model(const char filePath[], const float scale, shared_ptr<material> mat)
+{
+	// The file is mapped once, for hashing it against the cache and for reading, PLY meshes keep it mapped to use its vertices in place
+	shared_ptr<mapped_file> source = make_shared<mapped_file>(filePath);
+	if (!source->is_open()) {
 		std::clog << "Couldn't open file '" << filePath << "'\n";
 		// TODO: Not optimised as it converts char* to string to use some functions
 		const size_t last_slash_idx = std::string(filePath).rfind('/');
 		if (std::string::npos != last_slash_idx)
 		{
 			std::clog << "Here are a list of files in that folder\n";
-			for (const auto& entry : std::filesystem::directory_iterator(std::string(filePath).substr(0, last_slash_idx)))
+			std::error_code error; // The folder may not exist either, which shouldn't be fatal
+			for (const auto& entry : std::filesystem::directory_iterator(std::string(filePath).substr(0, last_slash_idx), error))
 				std::clog << entry.path() << std::endl;
 		}
+		return make_shared<quad>(vec3(0, 0, 0), vec3(1, 1, 1), vec3(0, 1, 1), mat);
+	}
+
+	// A cache next to the model keeps the triangles and built BVH, until the model, scale or BVH settings change
+	// Compressed meshes aren't cached, the cache file holds the full precision vertices and indices
+	std::string cache_path = mesh_cache::path_for(filePath);
+	mesh_cache_key cache_key;
+	bool use_cache = mesh_cache::enabled && !triangle_mesh::compress;
+	if (use_cache) {
+		auto load_start = std::chrono::steady_clock::now();
+		cache_key = mesh_cache::key(*source, scale);
+		if (shared_ptr<triangle_mesh> cached = mesh_cache::load(cache_path, cache_key, mat)) {
+			std::clog << "Loaded " << cached->triangle_count() << " triangles and their BVH from '" << cache_path << "' in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count() << "s\n";
+			return cached;
+		}
 	}
-	// Just incase nothing is loaded, it doesn't cause a massive crash
-	if (finalModel.objects.size() == 0) {
-		finalModel.add(make_shared<quad>(vec3(0, 0, 0), vec3(1, 1, 1), vec3(0, 1, 1), mat));
+
+	auto parse_start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point build_start;
+	size_t source_triangles = 0;
+	shared_ptr<triangle_mesh> mesh;
+	if (ply_reader::is_ply(source->data(), source->size())) {
+		ply_mesh parsed;
+		if (!ply_reader::read(source, scale, parsed)) {
+			std::clog << "Couldn't read PLY file '" << filePath << "'\n";
+			return make_shared<quad>(vec3(0, 0, 0), vec3(1, 1, 1), vec3(0, 1, 1), mat);
+		}
+		source_triangles = parsed.triangles.count;
+		std::clog << "Read " << parsed.vertices.count << " vertices and " << source_triangles << " triangles from '" << filePath << "' in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count() << "s ("
+			<< (parsed.vertices_in_place ? "vertices" : "no vertices") << " and " << (parsed.triangles_in_place ? "triangles" : "no triangles") << " read in place)\n";
+		if (parsed.skipped_triangles > 0)
+			std::clog << "Skipped " << parsed.skipped_triangles << " triangles referencing vertices that don't exist\n";
+		if (source_triangles == 0)
+			return make_shared<quad>(vec3(0, 0, 0), vec3(1, 1, 1), vec3(0, 1, 1), mat);
+
+		build_start = std::chrono::steady_clock::now();
+		mesh = make_shared<triangle_mesh>(parsed.owner, parsed.vertices, parsed.triangles, mat);
 	}
+	else {
+		obj_mesh parsed = obj_parser::parse(source->data(), source->size(), scale);
+		std::vector<float> positions = std::move(parsed.positions);
+		std::vector<uint32_t> indices = std::move(parsed.indices);
+		std::clog << "Read " << positions.size() / 3 << " vertices and " << indices.size() / 3 << " triangles from '" << filePath << "' in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count() << "s\n";
+		if (parsed.skipped_triangles > 0)
+			std::clog << "Skipped " << parsed.skipped_triangles << " triangles referencing vertices that don't exist\n";
+
+		// Just incase nothing is loaded, it doesn't cause a massive crash
+		if (indices.size() == 0) {
+			return make_shared<quad>(vec3(0, 0, 0), vec3(1, 1, 1), vec3(0, 1, 1), mat);
+		}
 
-	return make_shared<bvh_node>(finalModel);
+		build_start = std::chrono::steady_clock::now();
+		source_triangles = indices.size() / 3;
+		mesh = make_shared<triangle_mesh>(std::move(positions), std::move(indices), mat);
+	}
+	std::clog << "Built BVH over " << source_triangles << " triangles in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count() << "s (" << mesh->memory_bytes() / (1024 * 1024) << " MiB of mesh data";
+	if (mesh->is_compressed())
+		std::clog << ", " << mesh->vertex_count() << " vertices left after merging and " << mesh->triangle_count() << " triangles stored";
+	else if (mesh->triangle_count() > source_triangles)
+		std::clog << ", " << mesh->triangle_count() - source_triangles << " triangles repeated by spatial splits";
+	std::clog << ")\n";
+	if (use_cache && mesh_cache::save(cache_path, cache_key, *mesh))
+		std::clog << "Saved mesh cache '" << cache_path << "'\n";
+	return mesh;
 }
 #endif
\ No newline at end of file
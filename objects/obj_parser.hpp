@@ -0,0 +1,208 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Vertex positions and triangles read from a Wavefront OBJ file
+struct obj_mesh {
+	std::vector<float> positions; // x, y, z per vertex, already scaled
+	std::vector<uint32_t> indices; // Three vertices per triangle, n-gons are split into fans
+	size_t skipped_triangles = 0; // Triangles that referenced a vertex the file doesn't have
+};
+
+// OBJ reader over text already in memory (e.g. a mapped_file), numbers are read in place with std::from_chars
+// Only v and f lines are used: texture coordinates and normals aren't stored by triangle_mesh, so vt / vn lines and the /vt/vn parts of face corners are skipped
+// Large files are cut into line aligned chunks parsed on several threads, then joined in file order, so the result doesn't depend on the thread count
+class obj_parser {
+public:
+	static inline int threads = 0; // Threads parsing large files, 0 means every hardware thread
+
+	static obj_mesh parse(const char* data, size_t size, float scale) {
+		int thread_count = threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()));
+		size_t chunk_count = thread_count > 1 ? std::clamp<size_t>(size / min_chunk_bytes, 1, size_t(thread_count) * chunks_per_thread) : 1;
+
+		// Every chunk but the first starts after a line break, so no line is split between two chunks
+		std::vector<const char*> bounds(chunk_count + 1);
+		bounds[0] = data;
+		bounds[chunk_count] = data + size;
+		for (size_t c = 1; c < chunk_count; c++) {
+			const char* guess = std::max(data + size * c / chunk_count, bounds[c - 1]);
+			const char* line_break = static_cast<const char*>(std::memchr(guess, '\n', size_t(data + size - guess)));
+			bounds[c] = line_break != nullptr ? line_break + 1 : data + size;
+		}
+
+		std::vector<chunk> chunks(chunk_count);
+		if (thread_count > 1 && chunk_count > 1) {
+			task_pool pool(thread_count);
+			std::vector<task_pool::task_handle> parsed;
+			for (size_t c = 0; c < chunk_count; c++)
+				parsed.push_back(pool.submit([&, c]() { parse_chunk(bounds[c], bounds[c + 1], scale, chunks[c]); }));
+			for (const task_pool::task_handle& done : parsed)
+				pool.wait(done);
+		}
+		else {
+			for (size_t c = 0; c < chunk_count; c++)
+				parse_chunk(bounds[c], bounds[c + 1], scale, chunks[c]);
+		}
+
+		obj_mesh mesh = join(chunks, thread_count);
+
+		// Faces may reference vertices defined further down the file, so positive indices are only checked once every vertex is known
+		uint64_t vertex_count = mesh.positions.size() / 3;
+		size_t kept = 0;
+		for (size_t triangle = 0; triangle < mesh.indices.size(); triangle += 3) {
+			if (mesh.indices[triangle] >= vertex_count || mesh.indices[triangle + 1] >= vertex_count || mesh.indices[triangle + 2] >= vertex_count) {
+				mesh.skipped_triangles++;
+				continue;
+			}
+			std::copy_n(&mesh.indices[triangle], 3, &mesh.indices[kept]);
+			kept += 3;
+		}
+		mesh.indices.resize(kept);
+		// The mesh keeps these arrays, so the spare capacity left by growing them isn't kept around
+		mesh.positions.shrink_to_fit();
+		mesh.indices.shrink_to_fit();
+		return mesh;
+	}
+private:
+	static constexpr uint32_t invalid_index = UINT32_MAX;
+	static constexpr size_t min_chunk_bytes = size_t(1) << 20; // Smaller files aren't worth splitting
+	static constexpr size_t chunks_per_thread = 4; // Lets threads that finish early pick up more work
+
+	// The vertices and triangles of one range of lines, before its vertices are numbered across the whole file
+	struct chunk {
+		std::vector<float> positions;
+		std::vector<uint32_t> indices; // Zero based, except that relative ones count from the chunk's first vertex (modulo 2^32) until join adds its offset
+		std::vector<size_t> relative; // Entries of indices that came from negative (relative) indices
+		size_t vertex_offset = 0; // Vertices and indices in the chunks before this one
+		size_t index_offset = 0;
+	};
+
+	static obj_mesh join(std::vector<chunk>& chunks, int thread_count) {
+		// Prefix sums give each chunk its first vertex and first index, then every chunk copies itself into place and fixes up its relative indices
+		// Unsigned arithmetic wraps, so a relative index reaching back into an earlier chunk comes out right once the offset is added
+		size_t vertex_total = 0;
+		size_t index_total = 0;
+		for (chunk& part : chunks) {
+			part.vertex_offset = vertex_total;
+			part.index_offset = index_total;
+			vertex_total += part.positions.size() / 3;
+			index_total += part.indices.size();
+		}
+
+		obj_mesh mesh;
+		if (chunks.size() == 1) {
+			mesh.positions = std::move(chunks[0].positions);
+			mesh.indices = std::move(chunks[0].indices);
+			return mesh;
+		}
+		mesh.positions.resize(vertex_total * 3);
+		mesh.indices.resize(index_total);
+		auto place = [&](chunk& part) {
+			std::copy(part.positions.begin(), part.positions.end(), mesh.positions.begin() + 3 * part.vertex_offset);
+			std::copy(part.indices.begin(), part.indices.end(), mesh.indices.begin() + part.index_offset);
+			for (size_t entry : part.relative)
+				mesh.indices[part.index_offset + entry] += uint32_t(part.vertex_offset);
+			part = chunk();
+		};
+		if (thread_count > 1) {
+			task_pool pool(thread_count);
+			std::vector<task_pool::task_handle> placed;
+			for (chunk& part : chunks)
+				placed.push_back(pool.submit([&]() { place(part); }));
+			for (const task_pool::task_handle& done : placed)
+				pool.wait(done);
+		}
+		else {
+			for (chunk& part : chunks)
+				place(part);
+		}
+		return mesh;
+	}
+
+	static void parse_chunk(const char* begin, const char* end, float scale, chunk& out) {
+		std::vector<int64_t> corners; // Vertex indices of the face being read, kept between lines to reuse its memory
+		const char* line = begin;
+		while (line < end) {
+			const char* line_end = static_cast<const char*>(std::memchr(line, '\n', size_t(end - line)));
+			if (line_end == nullptr)
+				line_end = end;
+			parse_line(line, line_end, scale, out, corners);
+			line = line_end + 1;
+		}
+	}
+
+	static void parse_line(const char* p, const char* end, float scale, chunk& out, std::vector<int64_t>& corners) {
+		p = skip_space(p, end);
+		if (end - p < 2 || !is_space(p[1]))
+			return;
+
+		if (p[0] == 'v') {
+			// A fourth (w) coordinate is ignored, missing coordinates read as 0
+			p += 2;
+			for (int axis = 0; axis < 3; axis++) {
+				float value = 0;
+				p = skip_space(p, end);
+				if (p < end && *p == '+')
+					p++;
+				p = std::from_chars(p, end, value).ptr;
+				out.positions.push_back(value * scale);
+			}
+		}
+		else if (p[0] == 'f') {
+			// Corners are v, v/vt, v//vn or v/vt/vn, negative indices count back from the last vertex read so far
+			p += 2;
+			corners.clear();
+			while (true) {
+				p = skip_space(p, end);
+				if (p >= end || *p == '#')
+					break;
+				int64_t index = 0;
+				std::from_chars_result result = std::from_chars(p, end, index);
+				if (result.ec != std::errc())
+					index = 0;
+				p = result.ptr;
+				while (p < end && !is_space(*p))
+					p++;
+				corners.push_back(index);
+			}
+
+			// A fan from the first corner, which is exact for the convex polygons OBJ exporters write
+			for (size_t corner = 2; corner < corners.size(); corner++) {
+				add_corner(out, corners[0]);
+				add_corner(out, corners[corner - 1]);
+				add_corner(out, corners[corner]);
+			}
+		}
+	}
+
+	static void add_corner(chunk& out, int64_t index) {
+		// Anything that can't be a vertex becomes invalid_index (or wraps past the vertex count), which the check at the end of parse drops along with its triangle
+		if (index < 0) {
+			out.relative.push_back(out.indices.size());
+			out.indices.push_back(uint32_t(int64_t(out.positions.size() / 3) + index));
+		}
+		else {
+			out.indices.push_back(index == 0 || index > int64_t(invalid_index) ? invalid_index : uint32_t(index - 1));
+		}
+	}
+
+	static bool is_space(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static const char* skip_space(const char* p, const char* end) {
+		while (p < end && is_space(*p))
+			p++;
+		return p;
+	}
+};
+
+#endif
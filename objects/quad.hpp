@@ -28,41 +28,31 @@ public:
 	aabb bounding_box() const override { return bbox; }
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-		double denom = dot(normal, r.direction());
-
-		// No hit if the ray is parallel to the plane
-		if (std::fabs(denom) < 1e-8)
+		double t, alpha, beta;
+		if (!intersect(r, ray_t, t, alpha, beta))
 			return false;
 
-		// Return false if the hit point parameter t is outside the ray interval
-		// n.v = D, n.(P+td)=D, n.P + n.td = D, t = (D - n.P)/(n.d)
-		double t = (D - dot(normal, r.origin())) / denom;
-		if (!ray_t.contains(t))
-			return false;
-
-		// Determine the hit point lies within the planar shape using its plane coordinates
-		const point3 intersection = r.at(t);
-		// See derivatation in part 6.5
-		const vec3 planar_hitpt_vector = intersection - Q;
-		const double alpha = dot(w, cross(planar_hitpt_vector, v));
-		const double beta = dot(w, cross(u, planar_hitpt_vector));
-		if (!is_interior(alpha, beta, rec, intersection))
-			return false;
-		
-		// Ray hits the 2D shape, set the rest of the hit record data and return true
+		// Ray hits the 2D shape, set the hit record data and return true
 		rec.t = t;
-		rec.p = intersection;
+		rec.p = r.at(t);
+		set_uv(alpha, beta, rec);
 		rec.mat_ptr = mat.get();
 		rec.set_face_normal(r, normal);
 		return true;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		double t, alpha, beta;
+		return intersect(r, ray_t, t, alpha, beta);
+	}
+
 	double pdf_value(const point3& origin, const vec3& direction) const override {
-		hit_record rec;
-		if (!this->hit(ray(origin, direction), interval(0, infinity), rec))
+		// Only needs the distance to the light, the normal is the same everywhere on it
+		double t, alpha, beta;
+		if (!intersect(ray(origin, direction), interval(0, infinity), t, alpha, beta))
 			return 0;
-		double distance_squared = rec.t * rec.t * direction.length_squared();
-		double cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+		double distance_squared = t * t * direction.length_squared();
+		double cosine = std::fabs(dot(direction, normal) / direction.length());
 		return distance_squared / (cosine * area);
 	}
 
@@ -71,15 +61,19 @@ public:
 		return p - origin;
 	}
 
-	virtual bool is_interior(double a, double b, hit_record& rec, point3 intersection) const {
+	virtual primitive_type type() const { return primitive_quad; } // Which planar shape this is, for the hot path counters
+
+	virtual bool is_interior(double a, double b, const point3& intersection) const {
 		interval unit_interval = interval(0, 1);
-		// Given the hit point in plane coordinates, return false if it is outside the primitive, otherwise set the hit record UV coordinates and return true
+		// Given the hit point in plane coordinates, return whether it is inside the primitive
 
-		if (!unit_interval.contains(a) || !unit_interval.contains(b))
-			return false;
+		return unit_interval.contains(a) && unit_interval.contains(b);
+	}
+
+	virtual void set_uv(double a, double b, hit_record& rec) const {
+		// Texture coordinates of a hit point inside the primitive
 		rec.u = a;
 		rec.v = b;
-		return true;
 	}
 private:
 	point3 Q;
@@ -90,18 +84,40 @@ private:
 	vec3 normal;
 	double D; //Ax+By+Cz=D, where n = nxv
 	double area;
+
+	bool intersect(const ray& r, const interval& ray_t, double& t, double& alpha, double& beta) const {
+		// Shared by hit, occluded and pdf_value: finds t and the plane coordinates of the hit point without touching a hit record
+		RT_COUNT(primitive_tests[type()]);
+		double denom = dot(normal, r.direction());
+
+		// No hit if the ray is parallel to the plane
+		if (std::fabs(denom) < 1e-8)
+			return false;
+
+		// Return false if the hit point parameter t is outside the ray interval
+		// n.v = D, n.(P+td)=D, n.P + n.td = D, t = (D - n.P)/(n.d)
+		t = (D - dot(normal, r.origin())) / denom;
+		if (!ray_t.contains(t))
+			return false;
+
+		// Determine the hit point lies within the planar shape using its plane coordinates
+		const point3 intersection = r.at(t);
+		// See derivatation in part 6.5
+		const vec3 planar_hitpt_vector = intersection - Q;
+		alpha = dot(w, cross(planar_hitpt_vector, v));
+		beta = dot(w, cross(u, planar_hitpt_vector));
+		return is_interior(alpha, beta, intersection);
+	}
 };
 
 class triangle : public quad {
 public:
 	triangle(const point3& origin, const vec3& a, const vec3& b, shared_ptr <material> mat) : quad(origin, a, b, mat) {}
 
-	virtual bool is_interior(double a, double b, hit_record& rec, point3 intersection) const override {
-		if ((a + b) > 1 || a < 0 || b < 0)
-			return false;
-		rec.u = a;
-		rec.v = b;
-		return true;
+	primitive_type type() const override { return primitive_triangle; }
+
+	virtual bool is_interior(double a, double b, const point3& intersection) const override {
+		return (a + b) <= 1 && a >= 0 && b >= 0;
 	}
 };
 
@@ -109,26 +125,32 @@ class ellipse : public quad {
 public:
 	ellipse(const point3& centre, const vec3& a, const vec3& b, shared_ptr <material> mat) : quad(centre, a, b, mat) {}
 
-	virtual bool is_interior(double a, double b, hit_record& rec, point3 intersection) const override {
-		if ((a * a + b * b) > 1)
-			return false;
+	primitive_type type() const override { return primitive_ellipse; }
+
+	virtual bool is_interior(double a, double b, const point3& intersection) const override {
+		return (a * a + b * b) <= 1;
+	}
+
+	virtual void set_uv(double a, double b, hit_record& rec) const override {
 		rec.u = a / 2 + 0.5;
 		rec.v = b / 2 + 0.5;
-		return true;
 	}
 };
 
 class annulus : public quad {
 public:
 	annulus(const point3& center, const vec3& a, const vec3& b, double radius, shared_ptr<material> mat) : quad(center, a, b, mat), radius(radius) {}
+
+	primitive_type type() const override { return primitive_annulus; }
 	
-	virtual bool is_interior(double a, double b, hit_record& rec, point3 intersection) const override {
+	virtual bool is_interior(double a, double b, const point3& intersection) const override {
 		double distance = a * a + b * b;
-		if (distance > 1 || distance < radius * radius)
-			return false;
+		return distance <= 1 && distance >= radius * radius;
+	}
+
+	virtual void set_uv(double a, double b, hit_record& rec) const override {
 		rec.u = a / 2 + 0.5;
 		rec.v = b / 2 + 0.5;
-		return true;
 	}
 private:
 	double radius;
@@ -138,14 +160,12 @@ class texture_quad : public quad {
 public:
 	texture_quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<texture> tex, shared_ptr<material> mat) : quad(Q, u, v, mat), tex(tex) {}
 
-	virtual bool is_interior(double a, double b, hit_record& rec, point3 intersection) const override {
+	primitive_type type() const override { return primitive_texture_quad; }
+
+	virtual bool is_interior(double a, double b, const point3& intersection) const override {
 		interval unit_interval = interval(0, 1);
 
-		if (tex->value(a, b, intersection).length_squared() < 0.5 || !unit_interval.contains(a) || !unit_interval.contains(b)) // Does not hit if the texture is not white
-			return false;
-		rec.u = a;
-		rec.v = b;
-		return true;
+		return tex->value(a, b, intersection).length_squared() >= 0.5 && unit_interval.contains(a) && unit_interval.contains(b); // Does not hit if the texture is not white
 	}
 private:
 	shared_ptr<texture> tex;
@@ -23,24 +23,9 @@ public:
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
 		vec3 current_center = center.at(r.time());
-		vec3 oc = current_center - r.origin();
-		// Mathematically vec3.length_squared() is the same as dot of a vec3 with itself
-		double a = r.direction().length_squared();
-		double h = dot(r.direction(), oc); // The -2.0 will simplify itself out
-		double c = oc.length_squared() - radius * radius;
-		double discriminant = h * h - a * c; // Simplified out because of -2.0
-		if (discriminant < 0) {
+		double root;
+		if (!intersect(r, ray_t, current_center, root))
 			return false;
-		}
-		double sqrtd = std::sqrt(discriminant);
-
-		// Find the nearest root that lies in the acceptable range
-		double root = (h - sqrtd) / a;
-		if (!ray_t.surrounds(root)) {
-			root = (h + sqrtd) / a;
-			if (!ray_t.surrounds(root))
-				return false;
-		}
 
 		rec.t = root;
 		rec.p = r.at(root);
@@ -52,15 +37,26 @@ public:
 		return true;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		double root;
+		return intersect(r, ray_t, center.at(r.time()), root);
+	}
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
 
+	aabb bounding_box_at(double time) const override {
+		// The center moves linearly, so the boxes in between are exactly the interpolation of the start and end boxes
+		vec3 rvec = vec3(radius, radius, radius);
+		point3 current_center = center.at(time);
+		return aabb(current_center - rvec, current_center + rvec);
+	}
+
 	double pdf_value(const point3& origin, const vec3& direction) const override {
 		// The method only works for stationary spheres
 		// TODO: find a way to have moving spheres? p.s still works for some reason (i think)
-		hit_record rec;
-		if (!this->hit(ray(origin, direction), interval(0, infinity), rec))
+		if (!occluded(ray(origin, direction), interval(0, infinity)))
 			return 0;
 		double distance_squared = (center.at(0) - origin).length_squared();
 		double cos_theta_max = std::sqrt(1 - radius * radius / distance_squared);
@@ -81,6 +77,30 @@ private:
 
 	aabb bbox; // Bounding box
 
+	bool intersect(const ray& r, const interval& ray_t, const point3& current_center, double& root) const {
+		// Nearest root within ray_t, shared by hit and occluded
+		RT_COUNT(primitive_tests[primitive_sphere]);
+		vec3 oc = current_center - r.origin();
+		// Mathematically vec3.length_squared() is the same as dot of a vec3 with itself
+		double a = r.direction().length_squared();
+		double h = dot(r.direction(), oc); // The -2.0 will simplify itself out
+		double c = oc.length_squared() - radius * radius;
+		double discriminant = h * h - a * c; // Simplified out because of -2.0
+		if (discriminant < 0) {
+			return false;
+		}
+		double sqrtd = std::sqrt(discriminant);
+
+		// Find the nearest root that lies in the acceptable range
+		root = (h - sqrtd) / a;
+		if (!ray_t.surrounds(root)) {
+			root = (h + sqrtd) / a;
+			if (!ray_t.surrounds(root))
+				return false;
+		}
+		return true;
+	}
+
 	static void get_sphere_uv(const point3& p, double& u, double& v) {
 		// p: a given point on the sphere of radius one, centered at the origin
 		// u: returned value [0, 1] of angle around the Y axis from X = -1
@@ -0,0 +1,424 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Vertex positions read in place from memory laid out by someone else (e.g. a mapped PLY file)
+// Vertex i is three floats at data + i * stride, multiplied by scale as they are fetched
+struct vertex_view {
+	const char* data = nullptr;
+	size_t stride = 3 * sizeof(float);
+	size_t count = 0;
+	float scale = 1;
+};
+
+// Triangles read in place, triangle i is three 32 bit vertex indices at data + i * stride + offset
+struct triangle_view {
+	const char* data = nullptr;
+	size_t stride = 3 * sizeof(uint32_t);
+	size_t offset = 0;
+	size_t count = 0;
+};
+
+// Indexed triangle mesh with one material: float positions, three indices per triangle and its own BVH over the triangles
+// Costs roughly 12 bytes per vertex plus 16 per triangle and the BVH, instead of a triangle hittable (shared_ptr, double vectors, material reference) per face
+// With compress set, vertices are 16 bit offsets within the mesh's bounds (6 bytes) and indices 16 bit deltas in groups of triangles (about 6.5 bytes per triangle)
+class triangle_mesh : public bvh_hittable {
+public:
+	static inline bool compress = false; // --compress-meshes, for meshes built from now on
+	// positions holds x, y, z per vertex, indices three vertices per triangle (counter clockwise seen from the front)
+	triangle_mesh(std::vector<float> positions, std::vector<uint32_t> indices, shared_ptr<material> mat) : position_storage(std::move(positions)), mat(mat) {
+		vertices = { reinterpret_cast<const char*>(position_storage.data()), 3 * sizeof(float), position_storage.size() / 3, 1.0f };
+		build(indices.size() / 3, [&](size_t triangle, int corner) { return indices[3 * triangle + corner]; });
+	}
+
+	triangle_mesh(shared_ptr<const void> owner, vertex_view vertices, triangle_view triangles, shared_ptr<material> mat) : owner(owner), vertices(vertices), mat(mat) {
+		// Vertices and triangles in someone else's memory, e.g. a mapped PLY file, which owner keeps alive
+		// The vertices are used where they are, the triangles are only read while building, into the mesh's own leaf ordered index array
+		build(triangles.count, [&](size_t triangle, int corner) {
+			uint32_t index;
+			std::memcpy(&index, triangles.data + triangle * triangles.stride + triangles.offset + corner * sizeof(uint32_t), sizeof(uint32_t));
+			return index;
+		});
+	}
+
+	triangle_mesh(shared_ptr<const void> owner, std::span<const float> positions, std::span<const uint32_t> indices, std::span<const float> area_cdf, double total_area, bvh_hierarchy hierarchy, shared_ptr<material> mat)
+		: owner(owner), indices(indices), area_cdf(area_cdf), total_area(total_area), mat(mat), hierarchy(std::move(hierarchy)) {
+		// A mesh saved earlier from the accessors below (e.g. memory mapped from a cache), owner keeps the arrays alive
+		vertices = { reinterpret_cast<const char*>(positions.data()), 3 * sizeof(float), positions.size() / 3, 1.0f };
+	}
+
+	triangle_mesh(const triangle_mesh&) = delete;
+	triangle_mesh& operator=(const triangle_mesh&) = delete;
+
+	size_t triangle_count() const { return (compressed ? deltas.size() : indices.size()) / 3; } // Counts a triangle once per leaf it is in
+	size_t vertex_count() const { return compressed ? quantized.size() / 3 : vertices.count; }
+	bool is_compressed() const { return compressed; } // Compressed meshes can't be saved through the accessors below
+
+	// For saving the mesh, the indices are in the hierarchy's leaf order
+	// vertex_positions is empty when the vertices aren't packed x, y, z floats, packed_positions copies them out either way
+	std::span<const float> vertex_positions() const {
+		if (vertices.stride != 3 * sizeof(float) || vertices.scale != 1)
+			return {};
+		return std::span<const float>(reinterpret_cast<const float*>(vertices.data), vertices.count * 3);
+	}
+	std::span<const uint32_t> triangle_indices() const { return indices; }
+	std::span<const float> area_sums() const { return area_cdf; }
+	double surface_area() const { return total_area; }
+	const bvh_hierarchy& bvh() const { return hierarchy; }
+
+	std::vector<float> packed_positions() const {
+		// x, y, z per vertex with the scale applied, whatever the layout they are read from
+		std::vector<float> positions(vertices.count * 3);
+		for (size_t index = 0; index < vertices.count; index++) {
+			point3 p = vertex(uint32_t(index));
+			positions[3 * index] = float(p.x());
+			positions[3 * index + 1] = float(p.y());
+			positions[3 * index + 2] = float(p.z());
+		}
+		return positions;
+	}
+
+	size_t memory_bytes() const {
+		// Vertex, index and area arrays held by the mesh itself, the BVH nodes and mapped arrays aren't included
+		return position_storage.capacity() * sizeof(float) + index_storage.capacity() * sizeof(uint32_t) + area_storage.capacity() * sizeof(float) +
+			quantized.capacity() * sizeof(uint16_t) + group_bases.capacity() * sizeof(uint32_t) + deltas.capacity() * sizeof(uint16_t);
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		// Only the nearest triangle's hit record is filled in, after the traversal
+		uint32_t nearest = 0;
+		double nearest_u = 0, nearest_v = 0;
+		bool hit_anything = hierarchy.traverse(r, ray_t, [&](uint32_t position, interval& t) {
+			double t_hit, u, v;
+			if (!intersect(position, r, t, t_hit, u, v))
+				return false;
+			t.max = t_hit;
+			nearest = position;
+			nearest_u = u;
+			nearest_v = v;
+			return true;
+		});
+		if (!hit_anything)
+			return false;
+
+		point3 a, b, c;
+		corners(nearest, a, b, c);
+		vec3 edge1 = b - a;
+		vec3 edge2 = c - a;
+		rec.t = ray_t.max;
+		rec.p = r.at(rec.t);
+		rec.u = nearest_u;
+		rec.v = nearest_v;
+		rec.mat_ptr = mat.get();
+		rec.set_face_normal(r, unit_vector(cross(edge1, edge2)));
+		return true;
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override {
+		return hierarchy.traverse<true>(r, ray_t, [&](uint32_t position, interval& t) {
+			double t_hit, u, v;
+			return intersect(position, r, t, t_hit, u, v);
+		});
+	}
+
+	aabb bounding_box() const override {
+		return hierarchy.bounding_box();
+	}
+
+	double traversal_cost() const override {
+		return hierarchy.traversal_cost();
+	}
+
+	double pdf_value(const point3& origin, const vec3& direction) const override {
+		// Every point of the mesh is sampled with the same density, 1 / total_area
+		hit_record rec;
+		if (total_area <= 0 || !this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+			return 0;
+		double distance_squared = rec.t * rec.t * direction.length_squared();
+		double cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+		return distance_squared / (cosine * total_area);
+	}
+
+	vec3 random(const point3& origin) const override {
+		if (area_cdf.empty())
+			return vec3(1, 0, 0);
+		float target = float(random_double() * total_area);
+		size_t position = std::min(size_t(std::upper_bound(area_cdf.begin(), area_cdf.end(), target) - area_cdf.begin()), area_cdf.size() - 1);
+
+		// Uniform point on the triangle from two uniform numbers
+		double root = std::sqrt(random_double());
+		double along = random_double();
+		point3 a, b, c;
+		corners(position, a, b, c);
+		point3 p = a + root * (1 - along) * (b - a) + root * along * (c - a);
+		return p - origin;
+	}
+private:
+	// The arrays are either owned here or by owner
+	shared_ptr<const void> owner;
+	std::vector<float> position_storage;
+	std::vector<uint32_t> index_storage;
+	std::vector<float> area_storage;
+	vertex_view vertices;
+	std::span<const uint32_t> indices; // In the tree's leaf order
+	std::span<const float> area_cdf;
+	double total_area = 0;
+	shared_ptr<material> mat;
+	bvh_hierarchy hierarchy;
+
+	// Compressed storage, positions and indices above are left empty apart from the index_storage of wide groups
+	static constexpr size_t group_size = 8; // Triangles sharing one base index
+	static constexpr uint32_t wide_group = 0x80000000u; // Set in a group's base when its vertices are too far apart for 16 bit deltas
+	bool compressed = false;
+	std::vector<uint16_t> quantized; // x, y, z per vertex, as steps from origin
+	float origin[3] = {};
+	float step[3] = {};
+	std::vector<uint32_t> group_bases; // Smallest vertex of each group, or wide_group plus the group's first triangle in index_storage
+	std::vector<uint16_t> deltas; // Three per triangle, from its group's base
+
+	void corners(size_t position, point3& a, point3& b, point3& c) const {
+		// The vertices of the triangle at position in leaf order
+		if (!compressed) {
+			a = stored_vertex(indices[3 * position]);
+			b = stored_vertex(indices[3 * position + 1]);
+			c = stored_vertex(indices[3 * position + 2]);
+			return;
+		}
+		uint32_t base = group_bases[position / group_size];
+		if (base & wide_group) {
+			const uint32_t* wide = &index_storage[3 * (size_t(base & ~wide_group) + position % group_size)];
+			a = quantized_vertex(wide[0]);
+			b = quantized_vertex(wide[1]);
+			c = quantized_vertex(wide[2]);
+			return;
+		}
+		a = quantized_vertex(base + deltas[3 * position]);
+		b = quantized_vertex(base + deltas[3 * position + 1]);
+		c = quantized_vertex(base + deltas[3 * position + 2]);
+	}
+
+	point3 vertex(uint32_t index) const {
+		return compressed ? quantized_vertex(index) : stored_vertex(index);
+	}
+
+	point3 quantized_vertex(uint32_t index) const {
+		const uint16_t* q = &quantized[3 * size_t(index)];
+		return point3(origin[0] + float(q[0]) * step[0], origin[1] + float(q[1]) * step[1], origin[2] + float(q[2]) * step[2]);
+	}
+
+	point3 stored_vertex(uint32_t index) const {
+		// memcpy since a mapped file's vertices needn't be aligned to floats
+		float p[3];
+		std::memcpy(p, vertices.data + size_t(index) * vertices.stride, sizeof(p));
+		if (vertices.scale == 1)
+			return point3(p[0], p[1], p[2]);
+		return point3(p[0] * vertices.scale, p[1] * vertices.scale, p[2] * vertices.scale);
+	}
+
+	template<typename corner_index>
+	void build(size_t triangle_count, const corner_index& corner) {
+		// corner(triangle, 0..2) gives a triangle's vertices in the order they were read
+		if (!compress || vertices.count >= wide_group) {
+			build_hierarchy(triangle_count, corner);
+			return;
+		}
+		std::vector<uint32_t> merged = quantize(triangle_count, corner);
+		build_hierarchy(merged.size() / 3, [&](size_t triangle, int c) { return merged[3 * triangle + c]; });
+		encode_indices();
+	}
+
+	template<typename corner_index>
+	std::vector<uint32_t> quantize(size_t triangle_count, const corner_index& corner) {
+		// Rounds every vertex to the nearest of 65536 steps across the mesh's bounds on each axis, and merges vertices that round to the same point
+		// Returns the triangles over the merged vertices, less those that collapsed to a line or a point
+		constexpr float unbounded = std::numeric_limits<float>::infinity();
+		float low[3] = { unbounded, unbounded, unbounded }, high[3] = { -unbounded, -unbounded, -unbounded };
+		for (size_t index = 0; index < vertices.count; index++) {
+			point3 p = vertex(uint32_t(index));
+			for (int axis = 0; axis < 3; axis++) {
+				low[axis] = std::min(low[axis], float(p[axis]));
+				high[axis] = std::max(high[axis], float(p[axis]));
+			}
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			origin[axis] = vertices.count > 0 ? low[axis] : 0.0f;
+			step[axis] = vertices.count > 0 ? (high[axis] - low[axis]) / 65535.0f : 0.0f;
+		}
+
+		// Sorting the 48 bit quantized positions puts equal ones next to each other
+		std::vector<std::pair<uint64_t, uint32_t>> keys(vertices.count);
+		for (size_t index = 0; index < vertices.count; index++) {
+			point3 p = vertex(uint32_t(index));
+			uint64_t key = 0;
+			for (int axis = 0; axis < 3; axis++) {
+				double steps = step[axis] > 0 ? std::round((p[axis] - origin[axis]) / step[axis]) : 0.0;
+				key = (key << 16) | uint64_t(std::clamp(steps, 0.0, 65535.0));
+			}
+			keys[index] = { key, uint32_t(index) };
+		}
+		std::sort(keys.begin(), keys.end());
+		std::vector<uint32_t> merged_index(vertices.count);
+		for (size_t position = 0; position < keys.size(); position++) {
+			if (position == 0 || keys[position].first != keys[position - 1].first) {
+				for (int axis = 0; axis < 3; axis++)
+					quantized.push_back(uint16_t(keys[position].first >> (16 * (2 - axis))));
+			}
+			merged_index[keys[position].second] = uint32_t(quantized.size() / 3 - 1);
+		}
+		keys = std::vector<std::pair<uint64_t, uint32_t>>();
+
+		std::vector<uint32_t> merged;
+		merged.reserve(triangle_count * 3);
+		for (size_t triangle = 0; triangle < triangle_count; triangle++) {
+			uint32_t a = merged_index[corner(triangle, 0)], b = merged_index[corner(triangle, 1)], c = merged_index[corner(triangle, 2)];
+			if (a != b && b != c && a != c) {
+				merged.push_back(a);
+				merged.push_back(b);
+				merged.push_back(c);
+			}
+		}
+
+		// From here on vertices are read from quantized, the source positions (or the file holding them) aren't needed any more
+		compressed = true;
+		position_storage = std::vector<float>();
+		owner.reset();
+		vertices = {};
+		return merged;
+	}
+
+	void encode_indices() {
+		// Vertices are renumbered in the order the leaves first use them, so each group's vertices are close together
+		std::vector<uint32_t> renumbered(quantized.size() / 3, UINT32_MAX);
+		std::vector<uint16_t> reordered;
+		reordered.reserve(quantized.size());
+		for (uint32_t& index : index_storage) {
+			if (renumbered[index] == UINT32_MAX) {
+				renumbered[index] = uint32_t(reordered.size() / 3);
+				reordered.insert(reordered.end(), &quantized[3 * size_t(index)], &quantized[3 * size_t(index)] + 3);
+			}
+			index = renumbered[index];
+		}
+		quantized = std::move(reordered);
+
+		// Each group stores its smallest vertex and 16 bit deltas from it, groups spanning more than 65536 vertices keep full indices instead
+		size_t triangle_total = index_storage.size() / 3;
+		std::vector<uint32_t> wide;
+		group_bases.resize((triangle_total + group_size - 1) / group_size);
+		deltas.resize(index_storage.size());
+		for (size_t group = 0; group < group_bases.size(); group++) {
+			size_t first = group * group_size * 3, last = std::min(first + group_size * 3, index_storage.size());
+			uint32_t low = *std::min_element(&index_storage[first], &index_storage[0] + last);
+			uint32_t high = *std::max_element(&index_storage[first], &index_storage[0] + last);
+			if (high - low <= UINT16_MAX) {
+				group_bases[group] = low;
+				for (size_t entry = first; entry < last; entry++)
+					deltas[entry] = uint16_t(index_storage[entry] - low);
+			}
+			else {
+				group_bases[group] = wide_group | uint32_t(wide.size() / 3);
+				// Wide groups index into index_storage by position within the group, so they are stored as if full
+				wide.insert(wide.end(), &index_storage[first], &index_storage[0] + last);
+				wide.resize(wide.size() + (first + group_size * 3 - last));
+			}
+		}
+		index_storage = std::move(wide);
+		index_storage.shrink_to_fit();
+		indices = {};
+	}
+
+	template<typename corner_index>
+	void build_hierarchy(size_t triangle_count, const corner_index& corner) {
+		std::vector<aabb> boxes(triangle_count);
+		for (size_t index = 0; index < triangle_count; index++) {
+			point3 a = vertex(corner(index, 0)), b = vertex(corner(index, 1)), c = vertex(corner(index, 2));
+			boxes[index] = aabb(aabb(a, b), aabb(c, c));
+			boxes[index].pad_to_minimums();
+		}
+		hierarchy = bvh_hierarchy(boxes, {}, bvh_node::builder, [&](uint32_t index, int axis, double min, double max) {
+			return clipped_box(vertex(corner(index, 0)), vertex(corner(index, 1)), vertex(corner(index, 2)), axis, min, max);
+		});
+
+		// Triangles are stored in the tree's leaf order, so a leaf's triangles are next to each other in memory
+		// Spatial splits (bvh_sbvh) put some triangles in several leaves, and so store them more than once
+		const std::vector<uint32_t>& order = hierarchy.primitive_indices();
+		index_storage.resize(order.size() * 3);
+		for (size_t position = 0; position < order.size(); position++)
+			for (int c = 0; c < 3; c++)
+				index_storage[3 * position + c] = corner(order[position], c);
+		indices = index_storage;
+
+		// Running sum of the triangle areas, to pick triangles in proportion to their area when the mesh is a light
+		// Repeated triangles only count the first time, so they are never picked twice as often
+		std::vector<bool> counted(triangle_count, false);
+		area_storage.resize(order.size());
+		double area = 0;
+		for (size_t position = 0; position < order.size(); position++) {
+			if (!counted[order[position]]) {
+				counted[order[position]] = true;
+				point3 a = vertex(indices[3 * position]);
+				area += 0.5 * cross(vertex(indices[3 * position + 1]) - a, vertex(indices[3 * position + 2]) - a).length();
+			}
+			area_storage[position] = float(area);
+		}
+		area_cdf = area_storage;
+		total_area = area;
+		hierarchy.release_primitive_indices();
+	}
+
+	static aabb clipped_box(const point3& a, const point3& b, const point3& c, int axis, double min, double max) {
+		// Box of the part of the triangle between two planes along axis: its corners inside them and where its edges cross them
+		const point3 corners[3] = { a, b, c };
+		aabb box = aabb::empty;
+		for (int corner = 0; corner < 3; corner++) {
+			const point3& p = corners[corner];
+			const point3& q = corners[(corner + 1) % 3];
+			if (p[axis] >= min && p[axis] <= max)
+				box = aabb(box, aabb(p, p));
+			for (double plane : { min, max }) {
+				if ((p[axis] < plane && q[axis] > plane) || (p[axis] > plane && q[axis] < plane)) {
+					point3 crossing = p + (plane - p[axis]) / (q[axis] - p[axis]) * (q - p);
+					box = aabb(box, aabb(crossing, crossing));
+				}
+			}
+		}
+		return box;
+	}
+
+	bool intersect(uint32_t position, const ray& r, const interval& ray_t, double& t, double& u, double& v) const {
+		// Moller-Trumbore, u and v are the plane coordinates along the first and second edge like triangle::is_interior
+		RT_COUNT(primitive_tests[primitive_triangle]);
+		point3 a, b, c;
+		corners(position, a, b, c);
+		vec3 edge1 = b - a;
+		vec3 edge2 = c - a;
+
+		vec3 p = cross(r.direction(), edge2);
+		double determinant = dot(edge1, p);
+		// No hit if the ray is parallel to the plane
+		if (std::fabs(determinant) < 1e-12)
+			return false;
+		double inverse_determinant = 1.0 / determinant;
+
+		vec3 s = r.origin() - a;
+		u = dot(s, p) * inverse_determinant;
+		if (u < 0 || u > 1)
+			return false;
+		vec3 q = cross(s, edge1);
+		v = dot(r.direction(), q) * inverse_determinant;
+		if (v < 0 || u + v > 1)
+			return false;
+		t = dot(edge2, q) * inverse_determinant;
+		return ray_t.contains(t);
+	}
+};
+
+#endif
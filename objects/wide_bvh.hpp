@@ -0,0 +1,309 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "bvh_tree.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_SSE 1
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define RT_AVX2 1
+#endif
+
+// Node of a wide BVH: the boxes of all its children in structure of arrays floats, so one SIMD slab test covers every child
+template <int width>
+struct alignas(32) wide_bvh_node {
+	float min_x[width], min_y[width], min_z[width];
+	float max_x[width], max_y[width], max_z[width];
+	uint32_t child[width]; // Interior children: index of their wide node, leaves: their first entry in bvh_tree::primitive_indices
+	uint16_t count[width]; // Number of primitives in a leaf child, 0 for interior children
+	uint8_t child_count; // Slots in use, from the front
+};
+
+// How the child boxes of a wide_bvh_node move over the shutter, like linear_bvh_motion: the node's boxes are at time 0, adding these gives time 1
+template <int width>
+struct alignas(32) wide_bvh_motion {
+	float min_x[width], min_y[width], min_z[width];
+	float max_x[width], max_y[width], max_z[width];
+};
+
+// BVH with up to width (4 or 8) children per node, collapsed from a binary bvh_tree
+// The primitives keep the binary tree's order, so the same callback as bvh_tree::traverse works here
+template <int width>
+class wide_bvh_tree {
+public:
+	wide_bvh_tree() {}
+
+	wide_bvh_tree(const bvh_tree& tree) {
+		std::span<const linear_bvh_node> binary = tree.node_array();
+		if (binary.empty())
+			return;
+		node_storage.reserve(binary.size() / (width - 1) + 1);
+		collapse(binary, tree.motion_array(), 0);
+		node_storage.shrink_to_fit(); // The reserve above is an upper bound, nodes with leaf children leave it well short
+		motion.shrink_to_fit();
+		nodes = node_storage;
+	}
+
+	wide_bvh_tree(std::span<const wide_bvh_node<width>> nodes) : nodes(nodes) {
+		// A tree collapsed earlier (e.g. memory mapped from a cache), the nodes must outlive it
+	}
+
+	// Like bvh_tree, a copy would point into the original's node_storage
+	wide_bvh_tree(const wide_bvh_tree&) = delete;
+	wide_bvh_tree& operator=(const wide_bvh_tree&) = delete;
+	wide_bvh_tree(wide_bvh_tree&&) = default;
+	wide_bvh_tree& operator=(wide_bvh_tree&&) = default;
+
+	std::span<const wide_bvh_node<width>> node_array() const { return nodes; }
+
+	bool empty() const { return nodes.empty(); }
+	size_t node_count() const { return nodes.size(); }
+
+	template <bool any_hit = false, typename hit_function>
+	bool traverse(const ray& r, interval& ray_t, hit_function&& hit_primitive) const {
+		// Tests every child of a node at once, runs the primitives of hit leaves straight away, and visits the hit interior children nearest first
+		// With any_hit the walk stops at the first primitive hit, like bvh_tree::traverse
+		if (nodes.empty())
+			return false;
+		if (!motion.empty())
+			return walk<any_hit, true>(r, ray_t, hit_primitive);
+		return walk<any_hit, false>(r, ray_t, hit_primitive);
+	}
+private:
+	std::vector<wide_bvh_node<width>> node_storage; // Nodes of a tree collapsed here
+	std::span<const wide_bvh_node<width>> nodes; // node_storage, or nodes owned by someone else
+	std::vector<wide_bvh_motion<width>> motion; // One per node when the binary tree had motion, see bvh_tree::refit_motion
+
+	template <bool any_hit, bool moving, typename hit_function>
+	bool walk(const ray& r, interval& ray_t, hit_function&& hit_primitive) const {
+		// The loop of traverse, with moving the child boxes are first interpolated to the ray's time
+		const slab_ray slabs(r);
+		const float origin[3] = { float(r.origin().x()), float(r.origin().y()), float(r.origin().z()) };
+		const float inv_dir[3] = { float(slabs.inv_direction().x()), float(slabs.inv_direction().y()), float(slabs.inv_direction().z()) };
+		const int sign[3] = { slabs.direction_sign(0), slabs.direction_sign(1), slabs.direction_sign(2) };
+		const float time = float(r.time());
+
+		struct stack_entry {
+			uint32_t node;
+			float t_near;
+		};
+		stack_entry stack[64 * width];
+		int stack_size = 0;
+		stack[stack_size++] = { 0, float(ray_t.min) };
+		bool hit_anything = false;
+
+		while (stack_size > 0) {
+			stack_entry entry = stack[--stack_size];
+			if (entry.t_near > ray_t.max)
+				continue;
+			const wide_bvh_node<width>& node = nodes[entry.node];
+			RT_COUNT(bvh_node_visits);
+#ifdef RT_ENABLE_COUNTERS
+			thread_counters().box_tests += node.child_count;
+#endif
+
+			float t_near[width];
+			unsigned mask = intersect_children<moving>(node, moving ? &motion[entry.node] : nullptr, time, origin, inv_dir, sign, float(ray_t.min), float(ray_t.max), t_near);
+
+			// Leaves first, a hit there shrinks ray_t before choosing which interior children are worth visiting
+			int interior[width];
+			int interior_count = 0;
+			for (int c = 0; c < width; c++) {
+				if (!(mask & (1u << c)))
+					continue;
+				if (node.count[c] > 0) {
+					for (uint32_t p = node.child[c]; p < node.child[c] + node.count[c]; p++) {
+						if (hit_primitive(p, ray_t)) {
+							if constexpr (any_hit)
+								return true;
+							hit_anything = true;
+						}
+					}
+				}
+				else {
+					interior[interior_count++] = c;
+				}
+			}
+
+			// Pushed farthest first, so the nearest child is popped next
+			for (int a = 1; a < interior_count; a++)
+				for (int b = a; b > 0 && t_near[interior[b - 1]] < t_near[interior[b]]; b--)
+					std::swap(interior[b - 1], interior[b]);
+			for (int k = 0; k < interior_count; k++)
+				if (t_near[interior[k]] <= ray_t.max)
+					stack[stack_size++] = { node.child[interior[k]], t_near[interior[k]] };
+		}
+		return hit_anything;
+	}
+
+	uint32_t collapse(std::span<const linear_bvh_node> binary, std::span<const linear_bvh_motion> binary_motion, uint32_t root) {
+		// Turns the binary subtree at root into one wide node, by repeatedly opening the interior child with the largest surface area until the node is full
+		uint32_t node_index = uint32_t(node_storage.size());
+		node_storage.push_back(wide_bvh_node<width>());
+		if (!binary_motion.empty())
+			motion.push_back(wide_bvh_motion<width>());
+
+		uint32_t children[width];
+		int child_count = 0;
+		if (binary[root].count > 0) {
+			children[child_count++] = root;
+		}
+		else {
+			children[child_count++] = root + 1;
+			children[child_count++] = binary[root].offset;
+		}
+		while (child_count < width) {
+			int largest = -1;
+			float largest_area = -1;
+			for (int c = 0; c < child_count; c++) {
+				const linear_bvh_node& child = binary[children[c]];
+				if (child.count > 0)
+					continue;
+				float area = surface_area(child);
+				if (area > largest_area) {
+					largest_area = area;
+					largest = c;
+				}
+			}
+			if (largest < 0)
+				break;
+			uint32_t opened = children[largest];
+			children[largest] = opened + 1;
+			children[child_count++] = binary[opened].offset;
+		}
+
+		// Collapsing the children appends their nodes, so this node is only filled in afterwards
+		wide_bvh_node<width> node = {};
+		wide_bvh_motion<width> delta = {};
+		node.child_count = uint8_t(child_count);
+		for (int c = 0; c < child_count; c++) {
+			const linear_bvh_node& child = binary[children[c]];
+			node.min_x[c] = child.box_min[0];
+			node.min_y[c] = child.box_min[1];
+			node.min_z[c] = child.box_min[2];
+			node.max_x[c] = child.box_max[0];
+			node.max_y[c] = child.box_max[1];
+			node.max_z[c] = child.box_max[2];
+			node.count[c] = child.count;
+			node.child[c] = child.count > 0 ? child.offset : collapse(binary, binary_motion, children[c]);
+			if (!binary_motion.empty()) {
+				const linear_bvh_motion& child_motion = binary_motion[children[c]];
+				delta.min_x[c] = child_motion.delta_min[0];
+				delta.min_y[c] = child_motion.delta_min[1];
+				delta.min_z[c] = child_motion.delta_min[2];
+				delta.max_x[c] = child_motion.delta_max[0];
+				delta.max_y[c] = child_motion.delta_max[1];
+				delta.max_z[c] = child_motion.delta_max[2];
+			}
+		}
+		node_storage[node_index] = node;
+		if (!binary_motion.empty())
+			motion[node_index] = delta;
+		return node_index;
+	}
+
+	static float surface_area(const linear_bvh_node& node) {
+		float dx = node.box_max[0] - node.box_min[0];
+		float dy = node.box_max[1] - node.box_min[1];
+		float dz = node.box_max[2] - node.box_min[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	template <bool moving>
+	static unsigned intersect_children(const wide_bvh_node<width>& node, const wide_bvh_motion<width>* delta, float time, const float origin[3], const float inv_dir[3], const int sign[3], float t_min, float t_max, float t_near[width]) {
+		// Slab test of every child box, returns a bit per child that the ray enters within [t_min, t_max], and where it enters
+		// The ray's signs pick which of the min / max planes are entered first, like aabb::hit, so no per child min / max of the two is needed
+		// t_max is pushed out by a few float epsilons to make up for the rounding of the float arithmetic
+		// With moving, each plane is first moved to time by its delta
+		t_max *= 1.0f + 6.0f * std::numeric_limits<float>::epsilon();
+		unsigned used = (1u << node.child_count) - 1;
+		const float* mins[3] = { node.min_x, node.min_y, node.min_z };
+		const float* maxs[3] = { node.max_x, node.max_y, node.max_z };
+		const float* delta_mins[3] = {};
+		const float* delta_maxs[3] = {};
+		if constexpr (moving) {
+			delta_mins[0] = delta->min_x; delta_mins[1] = delta->min_y; delta_mins[2] = delta->min_z;
+			delta_maxs[0] = delta->max_x; delta_maxs[1] = delta->max_y; delta_maxs[2] = delta->max_z;
+		}
+#if RT_AVX2
+		if constexpr (width == 8) {
+			__m256 t_enter = _mm256_set1_ps(t_min);
+			__m256 t_exit = _mm256_set1_ps(t_max);
+			for (int axis = 0; axis < 3; axis++) {
+				__m256 o = _mm256_set1_ps(origin[axis]);
+				__m256 inv = _mm256_set1_ps(inv_dir[axis]);
+				__m256 near_plane = _mm256_load_ps(sign[axis] ? maxs[axis] : mins[axis]);
+				__m256 far_plane = _mm256_load_ps(sign[axis] ? mins[axis] : maxs[axis]);
+				if constexpr (moving) {
+					__m256 t = _mm256_set1_ps(time);
+					near_plane = _mm256_add_ps(near_plane, _mm256_mul_ps(t, _mm256_load_ps(sign[axis] ? delta_maxs[axis] : delta_mins[axis])));
+					far_plane = _mm256_add_ps(far_plane, _mm256_mul_ps(t, _mm256_load_ps(sign[axis] ? delta_mins[axis] : delta_maxs[axis])));
+				}
+				__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(near_plane, o), inv);
+				__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(far_plane, o), inv);
+				// The running value goes second, so a NaN slab (origin on the plane of an axis parallel ray) is ignored, like the scalar comparisons
+				t_enter = _mm256_max_ps(t0, t_enter);
+				t_exit = _mm256_min_ps(t1, t_exit);
+			}
+			_mm256_storeu_ps(t_near, t_enter);
+			return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ))) & used;
+		}
+#endif
+#if RT_SSE
+		if constexpr (width == 4) {
+			__m128 t_enter = _mm_set1_ps(t_min);
+			__m128 t_exit = _mm_set1_ps(t_max);
+			for (int axis = 0; axis < 3; axis++) {
+				__m128 o = _mm_set1_ps(origin[axis]);
+				__m128 inv = _mm_set1_ps(inv_dir[axis]);
+				__m128 near_plane = _mm_load_ps(sign[axis] ? maxs[axis] : mins[axis]);
+				__m128 far_plane = _mm_load_ps(sign[axis] ? mins[axis] : maxs[axis]);
+				if constexpr (moving) {
+					__m128 t = _mm_set1_ps(time);
+					near_plane = _mm_add_ps(near_plane, _mm_mul_ps(t, _mm_load_ps(sign[axis] ? delta_maxs[axis] : delta_mins[axis])));
+					far_plane = _mm_add_ps(far_plane, _mm_mul_ps(t, _mm_load_ps(sign[axis] ? delta_mins[axis] : delta_maxs[axis])));
+				}
+				__m128 t0 = _mm_mul_ps(_mm_sub_ps(near_plane, o), inv);
+				__m128 t1 = _mm_mul_ps(_mm_sub_ps(far_plane, o), inv);
+				t_enter = _mm_max_ps(t0, t_enter);
+				t_exit = _mm_min_ps(t1, t_exit);
+			}
+			_mm_storeu_ps(t_near, t_enter);
+			return unsigned(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit))) & used;
+		}
+#endif
+		// Scalar fallback, e.g. 8 wide nodes without AVX2
+		unsigned mask = 0;
+		for (int c = 0; c < node.child_count; c++) {
+			float t_enter = t_min;
+			float t_exit = t_max;
+			for (int axis = 0; axis < 3; axis++) {
+				float near_plane = sign[axis] ? maxs[axis][c] : mins[axis][c];
+				float far_plane = sign[axis] ? mins[axis][c] : maxs[axis][c];
+				if constexpr (moving) {
+					near_plane += time * (sign[axis] ? delta_maxs[axis][c] : delta_mins[axis][c]);
+					far_plane += time * (sign[axis] ? delta_mins[axis][c] : delta_maxs[axis][c]);
+				}
+				float t0 = (near_plane - origin[axis]) * inv_dir[axis];
+				float t1 = (far_plane - origin[axis]) * inv_dir[axis];
+				// Comparisons with a NaN are false, so NaN slabs are ignored here too
+				if (t0 > t_enter) t_enter = t0;
+				if (t1 < t_exit) t_exit = t1;
+			}
+			t_near[c] = t_enter;
+			if (t_enter <= t_exit)
+				mask |= 1u << c;
+		}
+		return mask;
+	}
+};
+
+#endif
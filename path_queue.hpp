@@ -0,0 +1,61 @@
+#ifndef PATH_QUEUE_H
+#define PATH_QUEUE_H
+
+#include "objects/hittable.hpp"
+
+#include <vector>
+
+// Structure of arrays state for a batch of paths the wavefront integrator traces together
+// Every array is indexed by path, so each stage (intersect, sort, shade) only streams through the fields it needs
+struct path_queue {
+	std::vector<point3> origins;
+	std::vector<vec3> directions;
+	std::vector<double> times;
+	std::vector<colour> throughputs;
+	std::vector<colour> radiances;
+	std::vector<int> pixels; // j * image_width + i
+	std::vector<uint64_t> sample_keys; // Picks the path's random stream for each bounce, see seed_bounce
+	std::vector<pcg32> generators; // The path's random state, carried from its intersection to its shading
+	std::vector<hit_record> hits;
+	std::vector<material_type> materials; // Shading groups, by the material that was hit
+
+	size_t size() const { return origins.size(); }
+
+	void add(const ray& r, int pixel, uint64_t sample_key) {
+		origins.push_back(r.origin());
+		directions.push_back(r.direction());
+		times.push_back(r.time());
+		throughputs.push_back(colour(1, 1, 1));
+		radiances.push_back(colour(0, 0, 0));
+		pixels.push_back(pixel);
+		sample_keys.push_back(sample_key);
+		generators.push_back(pcg32());
+		hits.push_back(hit_record());
+		materials.push_back(material_other);
+	}
+
+	ray get_ray(int path) const {
+		return ray(origins[path], directions[path], times[path]);
+	}
+
+	void set_ray(int path, const ray& r) {
+		origins[path] = r.origin();
+		directions[path] = r.direction();
+		times[path] = r.time();
+	}
+
+	void clear() {
+		origins.clear();
+		directions.clear();
+		times.clear();
+		throughputs.clear();
+		radiances.clear();
+		pixels.clear();
+		sample_keys.clear();
+		generators.clear();
+		hits.clear();
+		materials.clear();
+	}
+};
+
+#endif
@@ -23,4 +23,24 @@ private:
 	double tm;
 };
 
+// What a slab test needs from a ray, worked out once: the inverse direction and which way the ray points along each axis
+// Hierarchies make one per traversal rather than dividing at every node, in the space they are traversed in (an instance's object space gets its own)
+// Kept apart from ray so the rays that never reach a box test (scattering, light sampling) don't pay for the divisions
+class slab_ray {
+public:
+	slab_ray(const ray& r) : orig(r.origin()), inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z()) {
+		for (int axis = 0; axis < 3; axis++)
+			sign[axis] = inv_dir[axis] < 0;
+	}
+
+	const point3& origin() const { return orig; }
+	const vec3& inv_direction() const { return inv_dir; }
+	int direction_sign(int axis) const { return sign[axis]; } // 1 if the ray points down axis, so it enters a box through the max side
+
+private:
+	point3 orig;
+	vec3 inv_dir;
+	int sign[3];
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 random number generator (O'Neill, pcg-random.org)
+// Tiny state, fast, and much better statistical quality and period than std::rand
+class pcg32 {
+public:
+	pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+	void seed(uint64_t initstate, uint64_t initseq) {
+		state = 0;
+		inc = (initseq << 1) | 1;
+		next_uint();
+		state += initstate;
+		next_uint();
+	}
+
+	uint32_t next_uint() {
+		uint64_t old_state = state;
+		state = old_state * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+		uint32_t rot = uint32_t(old_state >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	double next_double() {
+		// Returns a random real in [0, 1)
+		return next_uint() * (1.0 / 4294967296.0);
+	}
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+inline uint64_t hash_combine(uint64_t a, uint64_t b) {
+	// SplitMix64 finaliser over both values, so neighbouring pixels / samples get unrelated seeds
+	uint64_t z = a ^ (b + 0x9e3779b97f4a7c15ULL + (a << 6) + (a >> 2));
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Each thread owns its generator, so threads never share (or fight over) random state
+// The generator is reseeded from (seed, pixel, sample, bounce) so every random number only depends on which sample it belongs to,
+// making renders reproducible no matter how many threads there are or in which order the tiles are traced
+struct random_stream {
+	pcg32 generator;
+	uint64_t sample_key = 0;
+};
+
+inline random_stream& thread_random_stream() {
+	thread_local random_stream stream;
+	return stream;
+}
+
+inline void seed_bounce(int bounce) {
+	// Bounce 0 is the camera ray itself, the integrator uses 1, 2, ... for each scattering event
+	random_stream& stream = thread_random_stream();
+	uint64_t key = hash_combine(stream.sample_key, uint64_t(bounce));
+	stream.generator.seed(key, stream.sample_key);
+}
+
+inline void seed_sample(uint64_t seed, uint64_t pixel, uint64_t sample) {
+	random_stream& stream = thread_random_stream();
+	stream.sample_key = hash_combine(hash_combine(hash_combine(0, seed), pixel), sample);
+	seed_bounce(0);
+}
+
+#endif
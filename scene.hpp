@@ -6,6 +6,7 @@
 #include "objects/constant_medium.hpp"
 #include "objects/hittable.hpp"
 #include "objects/hittable_list.hpp"
+#include "objects/instance.hpp"
 #include "material.hpp"
 #include "objects/quad.hpp"
 #include "objects/sphere.hpp"
@@ -16,13 +17,23 @@ class scene {
 public:
 	scene(camera cam, hittable_list world, hittable_list lights) : cam(cam), world(world), lights(lights) {}
 
-	void render(std::ostream& file) {
-		cam.render(file, world, lights, lights.objects.size() == 0 ? false : true);
+	void render(framebuffer& image) {
+		cam.render(image, world, lights, lights.objects.size() == 0 ? false : true);
 	}
-	void high_res_render(std::ostream& file, int samples) {
+	void high_res_render(framebuffer& image, int samples) {
 		cam.samples_per_pixel = samples;
 		cam.max_depth = 500;
-		cam.render(file, world, lights, lights.objects.size() == 0 ? false : true);
+		cam.render(image, world, lights, lights.objects.size() == 0 ? false : true);
+	}
+	camera& get_camera() {
+		return cam;
+	}
+	double traversal_cost() const {
+		// Expected intersection work for one ray through the world (see bvh_node::traversal_cost), every object in the world list is tested and anything that isn't a BVH counts as one intersection
+		double cost = 0;
+		for (const shared_ptr<hittable>& object : world.objects)
+			cost += bvh_node::hittable_cost(object);
+		return cost;
 	}
 private:
 	camera cam;
@@ -116,7 +127,7 @@ scene many_spheres(bool bouncing) {
 	shared_ptr<metal> material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
 	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
-	world = hittable_list(make_shared<bvh_node>(world));
+	world = hittable_list(make_bvh(world));
 
 	// Camera
 	camera cam;
@@ -442,15 +453,11 @@ scene cornell_box3() {
 	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
 	shared_ptr<dielectric> glass = make_shared<dielectric>(1.5);
-	shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), glass);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+	shared_ptr<hittable> box1 = make_shared<instance>(box(point3(0, 0, 0), point3(165, 330, 165), glass), transform::translation(vec3(265, 0, 295)) * transform::rotation_y(15));
 	world.add(box1);
 
 	shared_ptr<lambertian> blue = make_shared<lambertian>(colour(0.12, 0.45, 0.85));
-	shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), blue);
-	box2 = make_shared<rotate_y>(box2, -18);
-	box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+	shared_ptr<hittable> box2 = make_shared<instance>(box(point3(0, 0, 0), point3(165, 165, 165), blue), transform::translation(vec3(130, 0, 65)) * transform::rotation_y(-18));
 	world.add(box2);
 
 	shared_ptr<quad> qd = make_shared<quad>(point3(343, 554, 443), vec3(-130, 0, 0), vec3(0, 0, -105), light);
@@ -491,13 +498,9 @@ scene cornell_smoke() {
 	world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
 	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
-	shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+	shared_ptr<hittable> box1 = make_shared<instance>(box(point3(0, 0, 0), point3(165, 330, 165), white), transform::translation(vec3(265, 0, 295)) * transform::rotation_y(15));
 
-	shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-	box2 = make_shared<rotate_y>(box2, -18);
-	box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+	shared_ptr<hittable> box2 = make_shared<instance>(box(point3(0, 0, 0), point3(165, 165, 165), white), transform::translation(vec3(130, 0, 65)) * transform::rotation_y(-18));
 	world.add(make_shared<constant_medium>(box1, 0.01, colour(0, 0, 0)));
 	world.add(make_shared<constant_medium>(box2, 0.01, colour(1, 1, 1)));
 
@@ -527,6 +530,7 @@ scene cornell_smoke() {
 scene final_scene() {
 	hittable_list boxes1;
 	shared_ptr<lambertian> ground = make_shared<lambertian>(colour(0.48, 0.83, 0.53));
+	shared_ptr<hittable> unit_box = box(point3(0, 0, 0), point3(1, 1, 1), ground); // Every box is an instance of this one, scaled to its size
 
 	const int boxes_per_side = 20;
 	for (int i = 0; i < boxes_per_side; i++) {
@@ -535,16 +539,14 @@ scene final_scene() {
 			const double x0 = -1000.0 + i * w;
 			const double z0 = -1000.0 + j * w;
 			const double y0 = 0.0;
-			const double x1 = x0 + w;
 			const double y1 = random_double(1, 101);
-			const double z1 = z0 + w;
-			boxes1.add(box(vec3(x0, y0, z0), vec3(x1, y1, z1), ground));
+			boxes1.add(make_shared<instance>(unit_box, transform::translation(vec3(x0, y0, z0)) * transform::scaling(vec3(w, y1 - y0, w))));
 		}
 	}
 
 	hittable_list world;
 	hittable_list lights;
-	world.add(make_shared<bvh_node>(boxes1));
+	world.add(make_bvh(boxes1));
 
 	shared_ptr<diffuse_light> light = make_shared<diffuse_light>(colour(7, 7, 7));
 	shared_ptr<quad> qd = make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 300), light);
@@ -577,7 +579,7 @@ scene final_scene() {
 		boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
 	}
 
-	world.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2), 15), vec3(-100, 270, 395)));
+	world.add(make_shared<instance>(make_bvh(boxes2), transform::translation(vec3(-100, 270, 395)) * transform::rotation_y(15)));
 
 	camera cam;
 	
@@ -622,6 +624,7 @@ scene glass_boxes() {
 	constexpr double box_size = 50;
 	constexpr double box_spacing = 50;
 	constexpr double box_offset = 45;
+	shared_ptr<hittable> glass_box = box(vec3(0, 0, 0), vec3(box_size, box_size, box_size), glass);
 
 	for (int z = 0; z < cube_depth; z++) {
 		for (int y = 0; y < cube_depth; y++) {
@@ -634,11 +637,8 @@ scene glass_boxes() {
 				);
 				const double rot = (23 * x) + (13 * y) + (3 * z);
 
-				// Add it in
-				shared_ptr<hittable> box1 = box(vec3(0, 0, 0), vec3(box_size, box_size, box_size), glass);
-				box1 = make_shared<rotate_y>(box1, rot);
-				box1 = make_shared<translate>(box1, loc);
-				world.add(box1);
+				// Add it in, every box shares the same geometry
+				world.add(make_shared<instance>(glass_box, transform::translation(loc) * transform::rotation_y(rot)));
 			}
 		}
 	}
@@ -658,7 +658,7 @@ scene glass_boxes() {
 
 	cam.defocus_angle = 0;
 
-	return scene(cam, hittable_list(make_shared<bvh_node>(world)), lights);
+	return scene(cam, hittable_list(make_bvh(world)), lights);
 }
 
 scene bunny() {
@@ -692,7 +692,7 @@ scene bunny() {
 
 	cam.defocus_angle = 0;
 
-	return scene(cam, hittable_list(make_shared<bvh_node>(world)), lights);
+	return scene(cam, hittable_list(make_bvh(world)), lights);
 }
 
 scene dragon() {
@@ -726,7 +726,7 @@ scene dragon() {
 
 	cam.defocus_angle = 0;
 
-	return scene(cam, hittable_list(make_shared<bvh_node>(world)), lights);
+	return scene(cam, hittable_list(make_bvh(world)), lights);
 }
 
 scene obj_test() {
@@ -760,6 +760,61 @@ scene obj_test() {
 
 	cam.defocus_angle = 0;
 
-	return scene(cam, hittable_list(make_shared<bvh_node>(world)), lights);
+	return scene(cam, hittable_list(make_bvh(world)), lights);
+}
+
+// Scene indices used on the command line and by the benchmark
+const int scene_count = 19;
+
+inline const char* scene_name(int index) {
+	static const char* names[scene_count] = {
+		"three_spheres", "many_spheres", "bouncing_spheres", "checkered_spheres", "earth", "perlin_spheres", "quads", "quads2", "mandelbrot", "simple_light",
+		"cornell_box", "cornell_box2", "cornell_box3", "cornell_smoke", "final_scene", "glass_boxes", "bunny", "dragon", "obj_test"
+	};
+	return (index >= 0 && index < scene_count) ? names[index] : names[0];
+}
+
+scene select_scene(int index) {
+	switch (index)
+	{
+	case 1:
+		return many_spheres(false);
+	case 2:
+		return many_spheres(true);
+	case 3:
+		return checkered_spheres();
+	case 4:
+		return earth();
+	case 5:
+		return perlin_spheres();
+	case 6:
+		return quads();
+	case 7:
+		return quads2();
+	case 8:
+		return mandelbrot();
+	case 9:
+		return simple_light();
+	case 10:
+		return cornell_box();
+	case 11:
+		return cornell_box2();
+	case 12:
+		return cornell_box3();
+	case 13: // Black
+		return cornell_smoke();
+	case 14: // Black
+		return final_scene();
+	case 15:
+		return glass_boxes();
+	case 16:
+		return bunny();
+	case 17:
+		return dragon();
+	case 18:
+		return obj_test();
+	default:
+		return three_spheres();
+	}
 }
-#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small pool of worker threads for recursive jobs (e.g. building BVH subtrees)
+// A thread waiting for a job runs other queued jobs in the meantime, so jobs may submit and wait on jobs of their own without running out of threads
+class task_pool {
+public:
+	using task_handle = std::shared_ptr<std::atomic<bool>>; // Becomes true once the job has finished
+
+	task_pool(int thread_count) {
+		// The thread that waits counts as one of the threads, so with a thread count of 1 every job simply runs inside wait
+		for (int t = 1; t < thread_count; t++)
+			workers.emplace_back([this]() { work(); });
+	}
+
+	~task_pool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	task_handle submit(std::function<void()> job) {
+		task_handle done = std::make_shared<std::atomic<bool>>(false);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			jobs.push_back([job = std::move(job), done]() {
+				job();
+				done->store(true);
+			});
+		}
+		wake.notify_one();
+		return done;
+	}
+
+	void wait(const task_handle& done) {
+		while (!done->load()) {
+			if (!run_one())
+				std::this_thread::yield();
+		}
+	}
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	bool run_one() {
+		// Runs the newest queued job on this thread, returns false if there was none
+		std::function<void()> job;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (jobs.empty())
+				return false;
+			job = std::move(jobs.back());
+			jobs.pop_back();
+		}
+		job();
+		return true;
+	}
+
+	void work() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef TILE_QUEUE_H
+#define TILE_QUEUE_H
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// A rectangular block of pixels [x0, x1) x [y0, y1)
+struct tile {
+	int x0, y0;
+	int x1, y1;
+};
+
+// Work stealing queue of image tiles
+// Every worker gets its own deque of neighbouring tiles, it takes from the front of its own deque and once that runs dry, it steals from the back of the other workers' deques
+class tile_queue {
+public:
+	tile_queue(int image_width, int image_height, int tile_size, int worker_count) {
+		worker_count = (worker_count < 1) ? 1 : worker_count;
+		tile_size = (tile_size < 1) ? 1 : tile_size;
+
+		std::vector<tile> tiles;
+		for (int y = 0; y < image_height; y += tile_size)
+			for (int x = 0; x < image_width; x += tile_size)
+				tiles.push_back({ x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height) });
+		total = int(tiles.size());
+
+		// Hand each worker a contiguous run of tiles so it works on a coherent part of the image
+		queues.reserve(worker_count);
+		for (int w = 0; w < worker_count; w++)
+			queues.push_back(std::make_unique<worker_queue>());
+		for (int t = 0; t < total; t++)
+			queues[size_t(t) * worker_count / total]->tiles.push_back(tiles[t]);
+	}
+
+	int tile_count() const { return total; }
+
+	bool next(int worker, tile& t) {
+		// Takes the next tile for the worker, returns false once every queue is empty
+		{
+			worker_queue& own = *queues[worker];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.tiles.empty()) {
+				t = own.tiles.front();
+				own.tiles.pop_front();
+				return true;
+			}
+		}
+
+		int worker_count = int(queues.size());
+		for (int k = 1; k < worker_count; k++) {
+			worker_queue& victim = *queues[(worker + k) % worker_count];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tiles.empty()) {
+				t = victim.tiles.back();
+				victim.tiles.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+private:
+	struct worker_queue {
+		std::mutex lock;
+		std::deque<tile> tiles;
+	};
+
+	std::vector<std::unique_ptr<worker_queue>> queues; // Mutexes can't be moved, so each queue lives on the heap
+	int total = 0;
+};
+
+#endif